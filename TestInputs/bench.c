@@ -0,0 +1,344 @@
+// Replays allocation traces against the allocation policies and reports how
+// fast each one runs them and how tightly it packs them.
+//
+// A trace has one event per line. "a <id> <size>" allocates size bytes for
+// object id and "f <id>" frees that object again. Lines starting with # and
+// anything after those fields are ignored. Ids can be any number and can be
+// used again once their object is freed.
+//
+// usage: memory_bench [-p policy] [-m mem_size] [-s samples] [-t threads] trace...
+//
+// Every trace is replayed against policy (0 to 6), or against all of them
+// side by side if there is no -p, each in a fresh heap of mem_size bytes
+// (64M by default, k, m and g suffixes are understood). The heap is sampled
+// samples times (20 by default) along the way, and those samples are left
+// out of the timing.
+//
+// With -t, which needs a build with -DMEMALLOC_THREADS, every trace is
+// instead replayed by 1, 2, 4 and so on up to threads threads at once, each
+// running the whole trace on objects of its own. They share one heap of
+// mem_size bytes per thread. The throughput of all threads together is
+// reported, and how many times that of a single thread it is.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bench_common.h"
+
+#define MAX_SAMPLES 1000
+// As many threads as the allocator keeps caches for
+#define MAX_THREADS 64
+
+// The events of a trace. Objects are numbered in the order their ids first
+// show up.
+typedef struct Trace Trace;
+struct Trace {
+    Event *events;
+    size_t eventCount;
+    size_t objectCount;
+    // The most bytes live at once if every allocation succeeds
+    size_t peakLive;
+};
+
+// The heap as it was after a number of events
+typedef struct Sample Sample;
+struct Sample {
+    size_t events;
+    size_t live;
+    allocator_stats_t stats;
+};
+
+typedef struct Result Result;
+struct Result {
+    Run run;
+    Sample samples[MAX_SAMPLES];
+    int sampleCount;
+};
+
+// Maps the ids of a trace to object numbers while it is read. An open
+// addressing hash table that is kept at most half full.
+typedef struct IdTable IdTable;
+struct IdTable {
+    unsigned long *ids;
+    size_t *objects;
+    size_t size;
+    size_t count;
+};
+
+int readTrace(const char*, Trace*);
+size_t idObject(IdTable*, unsigned long);
+void replayTrace(Trace*, int, size_t, int, Result*);
+void addSample(void*, size_t, size_t, allocator_stats_t*);
+void report(const char*, Trace*, int*, int, Result*);
+#ifdef MEMALLOC_THREADS
+void scaleTrace(const char*, Trace*, int*, int, size_t, int);
+#endif
+
+int main(int argc, char **argv) {
+    int policies[POLICIES];
+    int policyCount = POLICIES;
+    size_t memSize = 64ul << 20;
+    int samples = 20;
+    int threads = 0;
+    for (int policy = 0; policy < POLICIES; policy++) {
+        policies[policy] = policy;
+    }
+
+    int option;
+    while ((option = getopt(argc, argv, "p:m:s:t:")) != -1) {
+        if (option == 'p') {
+            policies[0] = atoi(optarg);
+            policyCount = 1;
+        } else if (option == 'm') {
+            memSize = parseSize(optarg);
+        } else if (option == 's') {
+            samples = atoi(optarg);
+        } else if (option == 't') {
+            threads = atoi(optarg);
+            threads = (threads > 0) ? threads : -1;
+        } else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind >= argc || policies[0] < 0 || policies[0] >= POLICIES || memSize == 0 || samples < 1 || samples > MAX_SAMPLES
+        || threads < 0 || threads > MAX_THREADS) {
+        fprintf(stderr, "usage: %s [-p policy] [-m mem_size] [-s samples] [-t threads] trace...\n", argv[0]);
+        return 1;
+    }
+#ifndef MEMALLOC_THREADS
+    if (threads > 0) {
+        fprintf(stderr, "%s: -t needs a build with -DMEMALLOC_THREADS\n", argv[0]);
+        return 1;
+    }
+#endif
+
+    Result *results = malloc(policyCount * sizeof(Result));
+    for (int i = optind; i < argc; i++) {
+        Trace trace;
+        if (!readTrace(argv[i], &trace)) {
+            return 1;
+        }
+
+#ifdef MEMALLOC_THREADS
+        if (threads > 0) {
+            scaleTrace(argv[i], &trace, policies, policyCount, memSize, threads);
+            free(trace.events);
+            continue;
+        }
+#endif
+
+        for (int p = 0; p < policyCount; p++) {
+            replayTrace(&trace, policies[p], memSize, samples, &results[p]);
+        }
+        report(argv[i], &trace, policies, policyCount, results);
+        free(trace.events);
+    }
+
+    free(results);
+    return 0;
+}
+
+// Reads the trace in path into trace. Returns 0 after printing what is wrong
+// if it can't be read, has a line it doesn't understand or frees something
+// that isn't live.
+int readTrace(const char *path, Trace *trace) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    IdTable table = {NULL, NULL, 0, 0};
+    size_t capacity = 1024;
+    size_t liveCapacity = 1024;
+    size_t *liveSizes = calloc(liveCapacity, sizeof(size_t));
+    size_t live = 0;
+    trace->events = malloc(capacity * sizeof(Event));
+    trace->eventCount = 0;
+    trace->peakLive = 0;
+
+    char line[256];
+    int lineNumber = 0;
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        char op;
+        unsigned long id;
+        size_t size = 0;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+
+        int fields = sscanf(line, " %c %lu %zu", &op, &id, &size);
+        if (fields < 2 || (op != 'a' && op != 'f') || (op == 'a' && (fields < 3 || size == 0))) {
+            fprintf(stderr, "%s:%d: expected \"a <id> <size>\" or \"f <id>\"\n", path, lineNumber);
+            ok = 0;
+            break;
+        }
+
+        size_t object = idObject(&table, id);
+        if (object >= liveCapacity) {
+            liveSizes = realloc(liveSizes, 2 * liveCapacity * sizeof(size_t));
+            memset(liveSizes + liveCapacity, 0, liveCapacity * sizeof(size_t));
+            liveCapacity *= 2;
+        }
+        if ((op == 'a') != (liveSizes[object] == 0)) {
+            fprintf(stderr, "%s:%d: object %lu is %s\n", path, lineNumber, id, (op == 'a') ? "still live" : "not live");
+            ok = 0;
+            break;
+        }
+
+        if (op == 'a') {
+            liveSizes[object] = size;
+            live += size;
+            trace->peakLive = (live > trace->peakLive) ? live : trace->peakLive;
+        } else {
+            live -= liveSizes[object];
+            liveSizes[object] = 0;
+        }
+
+        if (trace->eventCount == capacity) {
+            capacity *= 2;
+            trace->events = realloc(trace->events, capacity * sizeof(Event));
+        }
+        trace->events[trace->eventCount].free = op == 'f';
+        trace->events[trace->eventCount].object = object;
+        trace->events[trace->eventCount].size = size;
+        trace->eventCount++;
+    }
+    trace->objectCount = table.count;
+
+    fclose(file);
+    free(liveSizes);
+    free(table.ids);
+    free(table.objects);
+    if (!ok) {
+        free(trace->events);
+    }
+    return ok;
+}
+
+// The object number of id, which is the next one if id is new
+size_t idObject(IdTable *table, unsigned long id) {
+    // Double the table once it is half full and re-insert every id
+    if ((table->count + 1) * 2 > table->size) {
+        IdTable old = *table;
+        table->size = (old.size == 0) ? 1024 : old.size * 2;
+        table->ids = malloc(table->size * sizeof(unsigned long));
+        table->objects = malloc(table->size * sizeof(size_t));
+        for (size_t i = 0; i < table->size; i++) {
+            table->objects[i] = (size_t)-1;
+        }
+        for (size_t i = 0; i < old.size; i++) {
+            if (old.objects[i] != (size_t)-1) {
+                size_t slot = (old.ids[i] * 11400714819323198485ul) >> (64 - __builtin_ctzl(table->size));
+                while (table->objects[slot] != (size_t)-1) {
+                    slot = (slot + 1) & (table->size - 1);
+                }
+                table->ids[slot] = old.ids[i];
+                table->objects[slot] = old.objects[i];
+            }
+        }
+        free(old.ids);
+        free(old.objects);
+    }
+
+    size_t slot = (id * 11400714819323198485ul) >> (64 - __builtin_ctzl(table->size));
+    while (table->objects[slot] != (size_t)-1) {
+        if (table->ids[slot] == id) {
+            return table->objects[slot];
+        }
+        slot = (slot + 1) & (table->size - 1);
+    }
+
+    table->ids[slot] = id;
+    table->objects[slot] = table->count++;
+    return table->objects[slot];
+}
+
+// Runs trace against policy in a heap of memSize bytes and fills in result,
+// sampling the heap samples times along the way
+void replayTrace(Trace *trace, int policy, size_t memSize, int samples, Result *result) {
+    result->sampleCount = 0;
+    Sampling sampling = {0, trace->eventCount, samples, addSample, result};
+    replay(trace->events, trace->eventCount, trace->objectCount, policy, memSize, &sampling, &result->run);
+}
+
+// Keeps a sample of the heap in the Result that is context
+void addSample(void *context, size_t events, size_t live, allocator_stats_t *stats) {
+    Result *result = context;
+    Sample *sample = &result->samples[result->sampleCount++];
+    sample->events = events;
+    sample->live = live;
+    sample->stats = *stats;
+}
+
+// Prints the results of every policy run on the trace at path side by side
+void report(const char *path, Trace *trace, int *policies, int policyCount, Result *results) {
+    printf("[TRACE %s] %zu events, %zu objects, at most %zu bytes live\n\n", path, trace->eventCount, trace->objectCount, trace->peakLive);
+
+    printf("%-14s %10s %10s %10s %14s %14s\n", "policy", "Mops/s", "failed", "peak live", "peak footprint", "footprint/live");
+    for (int p = 0; p < policyCount; p++) {
+        Run *run = &results[p].run;
+        double mops = (run->seconds > 0) ? trace->eventCount / run->seconds / 1e6 : 0;
+        double ratio = (run->peakLive > 0) ? (double)run->peakFootprint / run->peakLive : 0;
+        printf("%-14s %10.2f %10zu %10zu %14zu %14.2f\n", policyNames[policies[p]], mops, run->failures, run->peakLive, run->peakFootprint, ratio);
+    }
+
+    // Every policy is sampled after the same events
+    printf("\nfragmentation (1 - largest free / free) and free blocks over time\n");
+    printf("%10s %10s", "events", "live");
+    for (int p = 0; p < policyCount; p++) {
+        printf(" %14s", policyNames[policies[p]]);
+    }
+    printf("\n");
+    for (int s = 0; s < results[0].sampleCount; s++) {
+        printf("%10zu %10zu", results[0].samples[s].events, results[0].samples[s].live);
+        for (int p = 0; p < policyCount; p++) {
+            allocator_stats_t *stats = &results[p].samples[s].stats;
+            printf("   %5.3f %6zu", stats->fragmentation, stats->freeFragments);
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+#ifdef MEMALLOC_THREADS
+// Replays trace against every policy with 1, 2, 4 and so on up to maxThreads
+// threads at once, in a heap of memSize bytes per thread, and prints how
+// their throughput grows
+void scaleTrace(const char *path, Trace *trace, int *policies, int policyCount, size_t memSize, int maxThreads) {
+    int counts[MAX_THREADS];
+    int countCount = 0;
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        counts[countCount++] = threads;
+    }
+    counts[countCount++] = maxThreads;
+
+    printf("[TRACE %s] %zu events, %zu objects, replayed by 1 to %d threads at once\n\n", path, trace->eventCount, trace->objectCount, maxThreads);
+    printf("%-14s", "policy");
+    for (int c = 0; c < countCount; c++) {
+        printf(" %4d thread%s   ", counts[c], (counts[c] == 1) ? " " : "s");
+    }
+    printf(" %10s\n", "failed");
+
+    // Mops/s of all threads together and that over the Mops/s of one thread.
+    // The failures are those of the run with the most threads.
+    for (int p = 0; p < policyCount; p++) {
+        printf("%-14s", policyNames[policies[p]]);
+        double single = 0;
+        size_t failures = 0;
+        for (int c = 0; c < countCount; c++) {
+            Run run;
+            replayThreads(trace->events, trace->eventCount, trace->objectCount, policies[p], memSize, counts[c], &run);
+            double mops = (run.seconds > 0) ? (double)counts[c] * trace->eventCount / run.seconds / 1e6 : 0;
+            single = (c == 0) ? mops : single;
+            printf(" %8.2f %5.2fx", mops, (single > 0) ? mops / single : 0);
+            failures = run.failures;
+        }
+        printf(" %10zu\n", failures);
+    }
+    printf("\n");
+}
+#endif
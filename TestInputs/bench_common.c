@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef MEMALLOC_THREADS
+#include <pthread.h>
+#endif
+#include "bench_common.h"
+
+#ifdef MEMALLOC_THREADS
+// One of the threads of replayThreads
+typedef struct Replayer Replayer;
+struct Replayer {
+    Event *events;
+    size_t eventCount;
+    size_t objectCount;
+    allocator_t *heap;
+    pthread_barrier_t *start;
+    size_t failures;
+};
+
+void *replayThread(void*);
+#endif
+
+const char *policyNames[POLICIES] = {"first fit", "best fit", "worst fit", "buddy system", "next fit", "tlsf", "buddy tree"};
+
+// Runs events against policy in a fresh heap of memSize bytes and fills in
+// run. Allocations that fail are counted and their objects' frees skipped.
+void replay(Event *events, size_t eventCount, size_t objectCount, int policy, size_t memSize, Sampling *sampling, Run *run) {
+    // Aligned so that the slabs line up the same way on every run
+    void *memory = aligned_alloc(HEAP_ALIGNMENT, (memSize + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1));
+    allocator_t *heap = allocator_setup(policy, memSize, memory);
+    void **objects = calloc(objectCount, sizeof(void*));
+    size_t *sizes = calloc(objectCount, sizeof(size_t));
+
+    memset(run, 0, sizeof(Run));
+    size_t live = 0;
+    size_t interval = (sampling->end - sampling->start + sampling->samples - 1) / sampling->samples;
+    interval = (interval > 0) ? interval : 1;
+    double sampleTime = 0;
+    double start = now();
+
+    for (size_t i = 0; i < eventCount; i++) {
+        Event *event = &events[i];
+        if (!event->free) {
+            void *ptr = allocator_malloc(heap, event->size);
+            if (ptr == (void*)-1) {
+                run->failures++;
+            } else {
+                objects[event->object] = ptr;
+                sizes[event->object] = event->size;
+                live += event->size;
+
+                size_t end = ptr + event->size - memory;
+                run->peakFootprint = (end > run->peakFootprint) ? end : run->peakFootprint;
+                run->peakLive = (live > run->peakLive) ? live : run->peakLive;
+            }
+        } else if (objects[event->object] != NULL) {
+            allocator_free(heap, objects[event->object]);
+            objects[event->object] = NULL;
+            live -= sizes[event->object];
+        }
+
+        if (i + 1 >= sampling->start && i < sampling->end && ((i + 1 - sampling->start) % interval == 0 || i + 1 == sampling->end)) {
+            double sampleStart = now();
+            allocator_stats_t stats = allocator_stats(heap);
+            sampling->sample(sampling->context, i + 1, live, &stats);
+            sampleTime += now() - sampleStart;
+        }
+    }
+
+    run->seconds = now() - start - sampleTime;
+
+    allocator_destroy(heap);
+    free(memory);
+    free(objects);
+    free(sizes);
+}
+
+#ifdef MEMALLOC_THREADS
+// Runs events against policy in threads threads at once, each with its own
+// objects, in one fresh heap of memSize bytes for each thread. Fills in how
+// long it took from when all threads were ready until the last one was done,
+// and how many allocations failed in all. The heap isn't sampled and the
+// peaks are left 0.
+void replayThreads(Event *events, size_t eventCount, size_t objectCount, int policy, size_t memSize, int threads, Run *run) {
+    memSize *= threads;
+    void *memory = aligned_alloc(HEAP_ALIGNMENT, (memSize + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1));
+    allocator_t *heap = allocator_setup(policy, memSize, memory);
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    Replayer *replayers = malloc(threads * sizeof(Replayer));
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, threads + 1);
+
+    for (int i = 0; i < threads; i++) {
+        Replayer replayer = {events, eventCount, objectCount, heap, &start, 0};
+        replayers[i] = replayer;
+        pthread_create(&ids[i], NULL, replayThread, &replayers[i]);
+    }
+
+    memset(run, 0, sizeof(Run));
+    pthread_barrier_wait(&start);
+    double begin = now();
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        run->failures += replayers[i].failures;
+    }
+    run->seconds = now() - begin;
+
+    pthread_barrier_destroy(&start);
+    allocator_destroy(heap);
+    free(memory);
+    free(ids);
+    free(replayers);
+}
+
+// Replays the events of the Replayer that is arg once every thread is ready
+void *replayThread(void *arg) {
+    Replayer *replayer = arg;
+    void **objects = calloc(replayer->objectCount, sizeof(void*));
+    pthread_barrier_wait(replayer->start);
+
+    for (size_t i = 0; i < replayer->eventCount; i++) {
+        Event *event = &replayer->events[i];
+        if (!event->free) {
+            void *ptr = allocator_malloc(replayer->heap, event->size);
+            if (ptr == (void*)-1) {
+                replayer->failures++;
+            } else {
+                objects[event->object] = ptr;
+            }
+        } else if (objects[event->object] != NULL) {
+            allocator_free(replayer->heap, objects[event->object]);
+            objects[event->object] = NULL;
+        }
+    }
+
+    free(objects);
+    return NULL;
+}
+#endif
+
+// A size in bytes with an optional k, m or g suffix, or 0 if it isn't one
+size_t parseSize(const char *text) {
+    char *end;
+    size_t size = strtoul(text, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        size <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size <<= 20;
+        end++;
+    } else if (*end == 'g' || *end == 'G') {
+        size <<= 30;
+        end++;
+    }
+    return (*end == '\0') ? size : 0;
+}
+
+// Seconds on the monotonic clock
+double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
@@ -0,0 +1,49 @@
+// What memory_bench and memory_workload share: the policies they run, the
+// events they replay and the loops that replay them against one policy.
+#include <stddef.h>
+#include "memalloc.h"
+
+#define POLICIES 7
+#define HEAP_ALIGNMENT (1ul << 20)
+
+extern const char *policyNames[POLICIES];
+
+// One allocation or free. Objects are numbered densely from 0, so the replay
+// can keep them in an array.
+typedef struct Event Event;
+struct Event {
+    int free;
+    size_t object;
+    size_t size;
+};
+
+// What replaying events against one policy measured
+typedef struct Run Run;
+struct Run {
+    double seconds;
+    size_t failures;
+    // The highest address handed out, from the start of the heap's memory,
+    // and how many bytes were live at most
+    size_t peakFootprint;
+    size_t peakLive;
+};
+
+// When the replay looks at the heap: samples times, spread evenly over the
+// events from start up to end, the last time right after end. sample is
+// given the heap's counters, how many events were replayed and how many
+// bytes were live then. The time this takes isn't counted.
+typedef struct Sampling Sampling;
+struct Sampling {
+    size_t start;
+    size_t end;
+    int samples;
+    void (*sample)(void *context, size_t events, size_t live, allocator_stats_t *stats);
+    void *context;
+};
+
+void replay(Event *events, size_t eventCount, size_t objectCount, int policy, size_t memSize, Sampling *sampling, Run *run);
+#ifdef MEMALLOC_THREADS
+void replayThreads(Event *events, size_t eventCount, size_t objectCount, int policy, size_t memSize, int threads, Run *run);
+#endif
+size_t parseSize(const char *text);
+double now(void);
@@ -7,3 +7,21 @@ make compile_6
 make compile_7
 make compile_8
 make compile_9
+make compile_10
+make compile_11
+make compile_12
+make compile_13
+make compile_14
+make compile_15
+make compile_16
+make compile_17
+make compile_18
+make compile_19
+make compile_20
+make compile_21
+make compile_22
+make compile_23
+make compile_24
+make compile_25
+make compile_26
+make trace2text
@@ -1,5 +1,131 @@
-void setup(int malloc_type, int mem_size, void* start_of_memory);
-void *my_malloc(int size);
+#include <stddef.h>
+#include <stdio.h>
+
+// A heap managed by one of the allocation policies. setup/my_malloc/my_free
+// work on a process wide default allocator; the allocator_* functions below
+// take an explicit one so several heaps can be used independently.
+typedef struct Allocator allocator_t;
+
+// Or'ed into malloc_type, tells setup that the memory is all zero already
+// (fresh from mmap or calloc), so my_calloc doesn't have to clear it again
+#define MEMALLOC_ZEROED 0x100
+
+void setup(int malloc_type, size_t mem_size, void* start_of_memory);
+void *my_malloc(size_t size);
 void my_free(void *ptr);
 
+// Allocates n blocks of size bytes into out with a single search where the
+// policy allows it, carving them from one hole. Returns how many were
+// allocated, the rest of out is set to -1.
+size_t my_malloc_batch(size_t size, size_t n, void **out);
+// Frees n blocks at once, coalescing blocks that lie next to each other together
+void my_free_batch(void **ptrs, size_t n);
+
+// Allocates count * size bytes that are all zero, or returns -1. Only the
+// parts of the block that may have been written since setup get cleared.
+void *my_calloc(size_t count, size_t size);
+
+// Resizes the block at ptr to size bytes, in place whenever the space next to
+// it allows, otherwise by moving it. Returns the block's new address, or -1
+// with the old block left alone. A NULL ptr allocates, a size of 0 frees.
+void *my_realloc(void *ptr, size_t size);
+
+// Pointers from my_malloc are aligned to 16 bytes, or to MEMALLOC_ALIGNMENT
+// when the allocator is built with -DMEMALLOC_ALIGNMENT=64 (any power of two
+// from 16 to 1024). These return size bytes aligned to alignment, which has to
+// be a power of two, or -1. Free them with my_free.
+void *my_memalign(size_t alignment, size_t size);
+void *my_aligned_alloc(size_t alignment, size_t size);
+
+// Lets the heap grow when nothing fits, instead of returning -1. A request that
+// fails takes another region of at least increment bytes (more if it needs it)
+// from mmap, as long as the memory given to setup and every region added
+// stay within ceiling bytes, and the policy then searches all of them as one
+// heap. Only the fit policies (first, best, worst, next fit and TLSF) grow.
+void my_set_growth(size_t increment, size_t ceiling);
+
+// What allocator_stats returns, counted as the heap changes rather than by
+// walking it. Used bytes are whole blocks, headers included, and wasted bytes
+// the part of them callers didn't ask for: headers, rounding up to the
+// alignment or to a power of two, and the space in slabs not handed out.
+// Requests below 1 KiB count as the slab object they get. Fragmentation is
+// 1 - largestFree / freeBytes, how much of the free memory can't be had in one
+// request. For a shared heap the bytes are the whole heap's, the operation
+// counts this process's. Blocks in thread caches count as used.
+typedef struct {
+    int mallocType;
+    size_t usedBytes;
+    size_t requestedBytes;
+    size_t wastedBytes;
+    size_t freeBytes;
+    size_t largestFree;
+    size_t freeFragments;
+    double fragmentation;
+    unsigned long mallocs;
+    unsigned long frees;
+    unsigned long failures;
+} allocator_stats_t;
+allocator_stats_t my_stats(void);
+
+// Built with -DMEMALLOC_HISTOGRAMS, every my_malloc and my_free is timed and
+// counted in a histogram of latencies for its operation and size class (the
+// power of two range holding the size asked for, or for frees the size of the
+// block). This prints, for each one that was used, the number of calls and
+// their 50th, 99th and 99.9th percentile and longest latency, each rounded
+// up to the end of its bucket, which is at most a quarter of the value wide.
+// It prints nothing in a normal build, where the timing isn't compiled in.
+void my_dump_histograms(FILE *out);
+
+// Record mode. While it is on, every allocation and free is appended to fd as
+// a compact binary event (time since the event before, operation, size,
+// object and thread), buffered and written out in blocks of 1 MiB. A block
+// resized in place shows up as freed and allocated again. fd -1 turns it off
+// and writes out what is still buffered, as does allocator_destroy. Only turn
+// it on or off while no other thread uses the heap. trace2text turns the log
+// into the text traces memory_bench replays.
+void my_record(int fd);
+
+allocator_t *allocator_setup(int malloc_type, size_t mem_size, void* start_of_memory);
+void *allocator_malloc(allocator_t *allocator, size_t size);
+void allocator_free(allocator_t *allocator, void *ptr);
+size_t allocator_malloc_batch(allocator_t *allocator, size_t size, size_t n, void **out);
+void allocator_free_batch(allocator_t *allocator, void **ptrs, size_t n);
+void *allocator_calloc(allocator_t *allocator, size_t count, size_t size);
+void *allocator_realloc(allocator_t *allocator, void *ptr, size_t size);
+void *allocator_memalign(allocator_t *allocator, size_t alignment, size_t size);
+void allocator_destroy(allocator_t *allocator);
+
+// Like my_set_growth. When grow is not NULL, regions come from
+// grow(size, context) instead, which returns size bytes of memory aligned for
+// a pointer or NULL. allocator_destroy unmaps the regions from mmap, the ones
+// from grow belong to the caller.
+typedef void *(*allocator_grow_t)(size_t size, void *context);
+void allocator_set_growth(allocator_t *allocator, size_t increment, size_t ceiling, allocator_grow_t grow, void *context);
+allocator_stats_t allocator_stats(allocator_t *allocator);
+void allocator_dump_histograms(allocator_t *allocator, FILE *out);
+void allocator_record(allocator_t *allocator, int fd);
+
+// Shared heaps. The memory of a shared heap and all of its metadata live in
+// the file or POSIX shared memory object (from shm_open) open on fd, which
+// every process that wants to use the heap attaches to, each at its own
+// address. The first process to attach to an empty fd sizes it to mem_size
+// and sets the heap up, the others find it there. Any process can free what
+// another allocated. Shared heaps use the buddy tree policy and give requests
+// below 1 KiB a whole smallest buddy block, as slabs can't be shared.
+// allocator_destroy unmaps the heap, it lives on as long as its file does.
+// Returns NULL if fd can't be mapped or holds something else, or if mem_size
+// leaves no room for memory after the metadata, in which case fd stays empty.
+allocator_t *allocator_attach(int fd, size_t mem_size);
+// Pointers into a shared heap differ between processes, offsets from the
+// start of its region don't. These convert between the two.
+size_t allocator_offset(allocator_t *allocator, void *ptr);
+void *allocator_pointer(allocator_t *allocator, size_t offset);
 
+// Built with -DMEMALLOC_THREADS (and -pthread), every allocator may be used
+// from several threads at once: each thread keeps a small cache of the blocks
+// it freed and only takes the allocator's lock when that cache can't help.
+// A request a cached block can hold gets that block rather than the one the
+// policy would pick, so placement no longer matches the single threaded build.
+// A thread can hand its cached blocks back to the heap early with this, it
+// does nothing in a normal build.
+void allocator_thread_flush(allocator_t *allocator);
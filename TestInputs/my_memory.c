@@ -1,431 +1,3701 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "memalloc.h"
 
 #define FIRST_FIT 0
 #define BEST_FIT 1
 #define WORST_FIT 2
 #define BUDDY_SYSTEM 3
-
-const int MAX_MEM_SIZE = 1 << 20;
-const int MIN_MALLOC_SIZE = 1 << 10;
+#define NEXT_FIT 4
+#define TLSF 5
+#define BUDDY_TREE 6
+
+const size_t MIN_MALLOC_SIZE = 1 << 10;
+
+// One free list per power of two size class, enough to cover any size_t, so
+// huge holes get bins of their own instead of piling up in the last one
+#define NUM_BINS 64
+
+// TLSF cuts every power of two size class into 2^TLSF_SL_SHIFT free lists of
+// equal width. The smallest block is 16 bytes, so every list is at least one
+// byte wide.
+#define TLSF_SL_SHIFT 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_SHIFT)
+
+// Every pointer my_malloc returns is aligned to MEMALLOC_ALIGNMENT. Build with
+// -DMEMALLOC_ALIGNMENT=64 to keep blocks on separate cache lines.
+#ifndef MEMALLOC_ALIGNMENT
+#define MEMALLOC_ALIGNMENT 16
+#endif
+#if MEMALLOC_ALIGNMENT < 16 || MEMALLOC_ALIGNMENT > 1024 || (MEMALLOC_ALIGNMENT & (MEMALLOC_ALIGNMENT - 1)) != 0
+#error "MEMALLOC_ALIGNMENT must be a power of two from 16 to 1024"
+#endif
+
+// Every block has a HEADER_SIZE header holding its size as a size_t, right in
+// front of the pointer handed out, so blocks and memories can be larger than
+// 4 GiB. The fit policies round block sizes up to a multiple of
+// MEMALLOC_ALIGNMENT and start their first block HEADER_SIZE in front of an
+// aligned address, which keeps every pointer they hand out aligned.
+#define HEADER_SIZE sizeof(size_t)
+#define ROUND_UP(size) (((size) + MEMALLOC_ALIGNMENT - 1) & ~(size_t)(MEMALLOC_ALIGNMENT - 1))
+#define ROUND_DOWN(size) ((size) & ~(size_t)(MEMALLOC_ALIGNMENT - 1))
+
+// Buddy blocks start on aligned addresses, so they reserve a whole
+// MEMALLOC_ALIGNMENT in front of the pointer, the header being its last bytes
+#define BUDDY_HEADER_SIZE MEMALLOC_ALIGNMENT
+
+// Smallest buddy block: 2^11 is the first power of two that fits
+// MIN_MALLOC_SIZE plus its header
+const int MIN_BUDDY_ORDER = 11;
+
+// Boundary tags for the fit policies. The low bits of a header are free for
+// flags. Free blocks also end with a footer holding their size. Used blocks
+// don't need one, because the header of the block after them records that its
+// left neighbour is in use, so the footer is only ever read when it is there.
+#define TAG_USED 1
+#define TAG_PREV_USED 2
+#define TAG_SIZE(tag) ((tag) & ~(size_t)15 & ((1ul << TAG_REQUESTED_SHIFT) - 1))
+
+// An aligned buddy allocation hands out a pointer inside its block. The header
+// in front of it holds its distance from the block's start with this flag set.
+#define TAG_ALIGNED 4
+
+// Set in the header of a block that is freed but still looks used without the
+// lock: one in a thread cache, or a buddy block given back. A second free of it
+// is caught before it can be cached twice.
+#define TAG_FREED 8
+
+// A thread cache hands a block out again without the lock, so it can't update
+// the block's node. With MEMALLOC_THREADS, what was asked for of a fit block
+// small enough to be cached is kept in the top bits of its header instead,
+// where the cache can change it along with the rest of the header.
+#define TAG_REQUESTED_SHIFT 48
+#define TAG_REQUESTED(tag) ((tag) >> TAG_REQUESTED_SHIFT)
+
+// A free block needs room for both its header and its footer, and every
+// block is a multiple of MEMALLOC_ALIGNMENT, which is at least that
+const size_t MIN_BLOCK_SIZE = MEMALLOC_ALIGNMENT;
+
+// Slabs for requests below MIN_MALLOC_SIZE. A slab is one SLAB_SIZE block
+// taken from the allocator's policy wherever it fits, cut into equal objects
+// of one of SLAB_CLASSES power of two sizes (16 to 1024 bytes, but never below
+// MEMALLOC_ALIGNMENT). Objects carry no header and no MemoryNode, a bitmap of
+// SLAB_BITMAP_WORDS words in the slab tells which of them are handed out.
+#define SLAB_SHIFT 14
+#define SLAB_SIZE (1 << SLAB_SHIFT)
+#define MIN_SLAB_OBJECT_SHIFT 4
+#define SLAB_CLASSES 7
+#define SLAB_BITMAP_WORDS ((SLAB_SIZE >> MIN_SLAB_OBJECT_SHIFT) / 64)
+
+// Marks the start of a shared heap's region
+#define SHARED_MAGIC 0x6d656d616c6c6f63ul
+
+// MemoryNodes come from chunks of NODE_CHUNK_SIZE taken from the system
+// allocator, so splitting a block doesn't call malloc every time
+#define NODE_CHUNK_SIZE 256
+
+#ifdef MEMALLOC_THREADS
+// Operation counts and requestedBytes are bumped outside the allocator's lock
+#define COUNT(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#else
+#define COUNT(counter, n) ((counter) += (n))
+#endif
+
+// Record mode. Each event goes into the recorder's buffer as a few varints,
+// seven bits to a byte with the high bit set on all but the last: the
+// nanoseconds since the event before shifted left once with the operation in
+// the low bit, the thread, the object and, for allocations only, the size.
+// The object is the block's offset from memStart in units of
+// MEMALLOC_ALIGNMENT, zigzag encoded as regions can lie below memStart. The
+// buffer is written out whenever it might not hold another event, after
+// RECORD_MAGIC at the start of the log.
+#define RECORD_MALLOC 0
+#define RECORD_FREE 1
+#define RECORD_BUFFER_SIZE (1 << 20)
+#define RECORD_EVENT_MAX 40
+#define RECORD_MAGIC "memtrace"
+
+#ifdef MEMALLOC_HISTOGRAMS
+// Latency histograms. Every my_malloc and my_free is timed with the monotonic
+// clock and counted in one of HISTOGRAM_BUCKETS buckets, four per power of two
+// nanoseconds, for its operation and the size class of its size.
+#define HISTOGRAM_MALLOC 0
+#define HISTOGRAM_FREE 1
+#define HISTOGRAM_OPS 2
+#define HISTOGRAM_BUCKETS 160
+#endif
+
+#ifdef MEMALLOC_THREADS
+// Thread caches. Freed blocks of up to CACHE_MAX_SIZE bytes are kept per
+// thread in CACHE_CLASSES size classes (four per power of two) of up to
+// CACHE_DEPTH blocks each, and handed back out without taking any lock.
+// Larger blocks always go back to the heap, where any thread can use them.
+// Only the first MAX_THREADS live threads get a cache, any others always go
+// through the lock.
+#define MAX_THREADS 64
+#define CACHE_MAX_SHIFT 15
+#define CACHE_MAX_SIZE (1ul << CACHE_MAX_SHIFT)
+#define CACHE_CLASSES ((CACHE_MAX_SHIFT + 1) * 4)
+#define CACHE_DEPTH 8
+// Slab objects are cached per class as well, up to CACHE_OBJECT_DEPTH of each.
+// An empty class is refilled with half that many under one lock, a full one
+// gives half back the same way.
+#define CACHE_OBJECT_DEPTH 32
+#endif
 
 // Data Structures
 //  Doubly Linked list to keep track of memory
 typedef struct MemoryNode MemoryNode;
 struct MemoryNode {
-    //[size..4byte_header][start...size], totalsize=size+4
-    // size will always point to start, when returuning a pointer,
-    // just return start + 4
+    //[size..header][start...size], totalsize=size+HEADER_SIZE
+    // The header lives at start, when returuning a pointer,
+    // just return start + HEADER_SIZE
     void* start;
-    int* size;
+    size_t size;
+    // Address ordered links in memoryNodes, only used by the buddy system
     MemoryNode *prev;
     MemoryNode *next;
+    // Links for the size class or TLSF free list, only valid while used == 0
+    MemoryNode *binPrev;
+    MemoryNode *binNext;
+    // Links for the best fit and address ordered trees, also only valid while used == 0.
+    // maxSize is the largest size in the node's subtree.
+    MemoryNode *left;
+    MemoryNode *right;
+    int height;
+    size_t maxSize;
+    // Position in the worst fit heap, also only valid while used == 0
+    int heapIndex;
     int used;
+    // Everything from start + dirty to the end of the block is known to be
+    // zero, apart from the footer of a free fit policy block. Used blocks
+    // keep what they had when they were handed out.
+    size_t dirty;
+    // How many bytes the caller asked for, only valid while used == 1
+    size_t requested;
+};
+
+// A block of nodes for one allocator. Nodes are never given back to the
+// system on their own, only all chunks together when the allocator goes away.
+typedef struct NodeChunk NodeChunk;
+struct NodeChunk {
+    NodeChunk *next;
+    MemoryNode nodes[NODE_CHUNK_SIZE];
+};
+
+typedef struct MemoryList MemoryList;
+struct MemoryList {
+    MemoryNode *head;
+    MemoryNode *tail;
+    int size;
+};
+
+// Lives at the start of its slab. Objects are handed out from freeObjects
+// first, then from the never used space starting at unused.
+typedef struct Slab Slab;
+struct Slab {
+    // Links in the allocator's list of slabs with free objects for this class
+    Slab *prev;
+    Slab *next;
+    // The block the slab was given by the policy
+    void *block;
+    void *freeObjects;
+    void *unused;
+    void *firstObject;
+    int objectSize;
+    int capacity;
+    int freeCount;
+    // One bit per object, set while it is handed out. Objects in a thread
+    // cache count as free, so a second free of one is caught there too.
+    unsigned long handedOut[SLAB_BITMAP_WORDS];
+};
+
+// What a heap's blocks add up to. The counts change wherever blocks are handed
+// out or given back and wherever they go on or come off a free index, so
+// reading them costs nothing. requestedBytes is what callers asked for in the
+// used blocks, the rest of usedBytes went to headers, rounding and slab space
+// not handed out.
+typedef struct HeapUsage HeapUsage;
+struct HeapUsage {
+    size_t usedBytes;
+    size_t requestedBytes;
+    size_t freeBytes;
+    size_t freeFragments;
+};
+
+// Lives at the start of a shared heap's region, followed by its buddy tree and
+// then its memory. Each process maps the region at its own address, so
+// nothing in here is a pointer. The buddy tree's entries are positions in the
+// tree and its blocks' headers sizes and offsets already.
+typedef struct SharedHeader SharedHeader;
+struct SharedHeader {
+    unsigned long magic;
+    size_t regionSize;
+    size_t treeOffset;
+    int treeOrder;
+    size_t memOffset;
+    size_t memSize;
+    // Taken around every look at or change to the buddy tree or usage, by any process
+    pthread_mutex_t lock;
+    HeapUsage usage;
 };
 
-typedef struct MemoryList MemoryList;
-struct MemoryList {
-    MemoryNode *head;
-    MemoryNode *tail;
-    int size;
-};
+// A region taken when nothing fits, on top of the memory given to setup. It
+// lives at the start of its own memory and its blocks follow it up to end,
+// where a header that says used keeps merges from running past the region.
+// Slab windows are aligned to actual addresses, as for the fit policies.
+typedef struct Region Region;
+struct Region {
+    Region *next;
+    size_t size;
+    void *end;
+    // Whether it came from mmap rather than the allocator's grow callback
+    int mapped;
+    Slab **slabTable;
+    void *slabOrigin;
+    size_t slabWindows;
+};
+
+typedef struct Recorder Recorder;
+struct Recorder {
+    // -1 once a write has failed, the rest of the events are dropped then
+    int fd;
+    unsigned long lastTime;
+    size_t used;
+#ifdef MEMALLOC_THREADS
+    // Events from all threads go into the one buffer in the order they happen
+    pthread_mutex_t lock;
+#endif
+    unsigned char buffer[RECORD_BUFFER_SIZE];
+};
+
+#ifdef MEMALLOC_THREADS
+// Blocks a thread has freed but not yet returned to the heap. They are still
+// marked used in the heap, so nothing else can hand them out.
+typedef struct ThreadCache ThreadCache;
+struct ThreadCache {
+    int count[CACHE_CLASSES];
+    void *blocks[CACHE_CLASSES][CACHE_DEPTH];
+    int objectCount[SLAB_CLASSES];
+    void *objects[SLAB_CLASSES][CACHE_OBJECT_DEPTH];
+};
+
+// The cache of the thread holding one slot. Only that thread sets up cache,
+// the first time it frees something. held is the cache whenever nobody is
+// using it. Whoever uses it swaps NULL in and puts it back when done: its own
+// thread on every malloc and free, and a thread whose allocation failed when
+// it takes every cache's blocks back to the heap. Neither ever waits for the
+// other, the owner goes to the heap instead and the other thread skips the
+// cache. Slots are a cache line each, so their owners don't slow each other down.
+typedef struct CacheSlot CacheSlot;
+struct CacheSlot {
+    ThreadCache *cache;
+    ThreadCache *held;
+    char padding[64 - 2 * sizeof(ThreadCache*)];
+};
+#endif
+
+// Everything one heap needs. Each allocator_t manages its own memory and
+// metadata, so several heaps can live side by side in one process.
+struct Allocator {
+    int mallocType;
+    size_t memSize;
+    void* memStart;
+
+    // Regions added since setup, newest first. They grow the heap by at least
+    // growIncrement bytes at a time, for as long as memSize and all regions
+    // together stay within growCeiling. No request larger than memLimit can fit.
+    Region *regions;
+    size_t growIncrement;
+    size_t growCeiling;
+    size_t growTotal;
+    allocator_grow_t grow;
+    void *growContext;
+    size_t memLimit;
+
+    // The buddy system keeps all its nodes in address order here
+    MemoryList memoryNodes;
+
+    // Every node of the allocator lives in one of nodeChunks. Nodes that are
+    // not in use are kept on freeNodes, linked through next.
+    NodeChunk *nodeChunks;
+    MemoryNode *freeNodes;
+
+    // Free lists for the buddy system. Bin i holds the free blocks whose size
+    // is in [2^i, 2^(i+1)). Bit i of freeBinMap is set whenever bin i is
+    // non-empty so searches can skip straight to useful bins.
+    MemoryList freeBins[NUM_BINS];
+    unsigned long freeBinMap;
+
+    // Best fit keeps its free nodes in an AVL tree ordered by size and then by
+    // address, so the smallest hole that fits is found in O(log n).
+    MemoryNode *bestFitTree;
+
+    // First fit and next fit use the same kind of tree, ordered by address
+    // alone. Through maxSize it finds the lowest hole that fits in O(log n),
+    // for next fit the lowest at or after nextFitRover, where the last
+    // allocation ended.
+    MemoryNode *addressTree;
+    void *nextFitRover;
+
+    // TLSF keeps its free nodes in tlsfLists[i][j], the j-th slice of size class
+    // i. Bit i of tlsfFlMap is set whenever class i has a non-empty list and bit
+    // j of tlsfSlMap[i] whenever list j does, so a list that fits is found with
+    // two find-first-set, however many holes there are.
+    MemoryNode *tlsfLists[NUM_BINS][TLSF_SL_COUNT];
+    unsigned long tlsfFlMap;
+    unsigned int tlsfSlMap[NUM_BINS];
+
+    // Worst fit keeps its free nodes in a binary max heap ordered by size and then
+    // by lowest address, so the largest hole is always worstFitHeap[0].
+    MemoryNode **worstFitHeap;
+    int worstFitHeapSize;
+    int worstFitHeapCapacity;
+
+    // The buddy system's free lists hold one order each (a block of order k
+    // is exactly 2^k bytes). It also indexes every block by its offset from
+    // memStart in units of the smallest block, so a block's buddy is found by XOR.
+    MemoryNode **buddyTable;
+
+    // The buddy tree policy keeps no nodes at all. buddyTree is an implicit
+    // binary tree over the memory rounded up to 2^buddyTreeOrder bytes: entry 1
+    // is the whole of it and entries 2i and 2i+1 are the two halves of entry i,
+    // down to blocks of the smallest size. Each entry holds one more than the
+    // order of the largest free block inside it, or 0 if there is none, so the
+    // tree takes two bytes per smallest block and is only allocated once.
+    unsigned char *buddyTree;
+    int buddyTreeOrder;
+
+    // Where this process mapped the region of a shared heap, NULL for others.
+    // buddyTree then points into the region as well.
+    SharedHeader *shared;
+
+    // Counters for allocator_stats. usage points at ownUsage, or into the
+    // region of a shared heap, as its processes all change the same blocks.
+    // The operation counts are always this process's own.
+    HeapUsage *usage;
+    HeapUsage ownUsage;
+    unsigned long mallocs;
+    unsigned long frees;
+    unsigned long failures;
+
+    // Where allocations and frees are recorded while record mode is on
+    Recorder *recorder;
+
+    // The fit policies start a block wherever a hole does, on any multiple of
+    // MEMALLOC_ALIGNMENT, so unlike buddy blocks theirs have no grid to index
+    // them by. Their nodes are indexed by start address in an open addressing
+    // hash table instead. It is kept at most half full, which lets my_free find
+    // a node without walking the list.
+    MemoryNode **nodeTable;
+    size_t nodeTableSize;
+    size_t nodeTableCount;
+
+    // slabs[c] lists the slabs of class c that still have free objects.
+    // slabTable maps every SLAB_SIZE window from slabOrigin on to the slab
+    // starting in it, if any, which is how my_free tells slab objects from
+    // other blocks. A slab is no bigger than a window, so it reaches at most
+    // into the next one. Buddy blocks are aligned from memStart, so their
+    // windows start there and each slab fills one. The fit policies' windows
+    // are aligned to actual addresses.
+    Slab *slabs[SLAB_CLASSES];
+    Slab **slabTable;
+    void *slabOrigin;
+    size_t slabWindows;
+
+#ifdef MEMALLOC_HISTOGRAMS
+    // histograms[op][c][b] is how many calls of op for a size in size class c
+    // took a time in bucket b
+    unsigned long histograms[HISTOGRAM_OPS][NUM_BINS][HISTOGRAM_BUCKETS];
+#endif
+
+#ifdef MEMALLOC_THREADS
+    // Guards everything above. caches[i] belongs to the thread holding slot i.
+    // A thread may take this lock while it holds a cache, never the other way round.
+    pthread_mutex_t lock;
+    CacheSlot caches[MAX_THREADS];
+#endif
+};
+
+// Function prototypes
+void listTailInsert(MemoryList*, MemoryNode*);
+void listHeadInsert(MemoryList*, MemoryNode*);
+void listInsertAfter(MemoryList*, MemoryNode*, MemoryNode*);
+void listDelete(MemoryList*, MemoryNode*);
+int sizeClass(size_t);
+void binDelete(allocator_t*, MemoryNode*);
+void binPush(allocator_t*, MemoryNode*);
+void freeInsert(allocator_t*, MemoryNode*);
+void freeDelete(allocator_t*, MemoryNode*);
+int treeHeight(MemoryNode*);
+void treeUpdate(MemoryNode*);
+int treeLess(MemoryNode*, MemoryNode*, int);
+MemoryNode* treeRotate(MemoryNode*, int);
+MemoryNode* treeBalance(MemoryNode*);
+MemoryNode* treeInsert(MemoryNode*, MemoryNode*, int);
+MemoryNode* treeDelete(MemoryNode*, MemoryNode*, int);
+MemoryNode* treeRemoveMin(MemoryNode*, MemoryNode**);
+MemoryNode* treeFindFrom(MemoryNode*, void*, size_t);
+int heapAbove(MemoryNode*, MemoryNode*);
+void heapPlace(allocator_t*, MemoryNode*, int);
+void heapSiftUp(allocator_t*, MemoryNode*);
+void heapSiftDown(allocator_t*, MemoryNode*);
+void heapInsert(allocator_t*, MemoryNode*);
+void heapDelete(allocator_t*, MemoryNode*);
+MemoryNode* takeNode(allocator_t*, MemoryNode*, size_t);
+void buddySetup(allocator_t*);
+MemoryNode* buddyAlloc(allocator_t*, size_t);
+void *buddyAllocAligned(allocator_t*, size_t, size_t);
+void buddyFree(allocator_t*, MemoryNode*);
+size_t nodeTableSlot(allocator_t*, void*);
+void nodeTableInsert(allocator_t*, MemoryNode*);
+void nodeTableDelete(allocator_t*, MemoryNode*);
+MemoryNode* nodeTableFind(allocator_t*, void*);
+void printList(allocator_t*, int);
+MemoryNode* createNewNode(allocator_t*, void*, size_t);
+void releaseNode(allocator_t*, MemoryNode*);
+MemoryNode* split(allocator_t*, MemoryNode*, size_t);
+void merge(allocator_t*, MemoryNode*);
+MemoryNode* findFirstfit(allocator_t*, size_t);
+MemoryNode* findBestFit(allocator_t*, size_t);
+MemoryNode* findWorstFit(allocator_t*, size_t);
+MemoryNode* findNextFit(allocator_t*, size_t);
+MemoryNode* findTlsf(allocator_t*, size_t);
+void tlsfMapping(size_t, int*, int*);
+void tlsfInsert(allocator_t*, MemoryNode*);
+void tlsfDelete(allocator_t*, MemoryNode*);
+void setFreeTags(void*, size_t);
+void setPrevUsed(allocator_t*, void*, int);
+void *allocateBlock(allocator_t*, size_t);
+void releaseBlock(allocator_t*, void*);
+size_t dirtyBytes(allocator_t*, void*);
+size_t allocateBatch(allocator_t*, size_t, size_t, void**);
+int compareAddresses(const void*, const void*);
+int resizeBlock(allocator_t*, void*, size_t, size_t*);
+int buddyResize(allocator_t*, MemoryNode*, size_t);
+void buddyTreeSetup(allocator_t*);
+void buddyTreeUpdate(allocator_t*, size_t);
+int buddyTreeOrderOf(allocator_t*, size_t);
+void *buddyTreeAlloc(allocator_t*, size_t, size_t);
+size_t buddyTreeFind(allocator_t*, size_t);
+void buddyTreeFree(allocator_t*, size_t);
+void buddyTreePrint(allocator_t*, size_t);
+int buddyTreeOrderFor(size_t);
+void sharedLock(allocator_t*);
+void sharedUnlock(allocator_t*);
+MemoryNode* findFreeNode(allocator_t*, size_t);
+MemoryNode* carve(allocator_t*, MemoryNode*, size_t);
+void *allocateAligned(allocator_t*, size_t, size_t);
+void *allocateAlignedBlock(allocator_t*, size_t, size_t);
+int slabClass(int);
+Slab* slabFor(allocator_t*, void*);
+Slab* slabLoad(Slab**);
+void slabSet(allocator_t*, void*, Slab*);
+Slab** slabTableFor(allocator_t*, void*, size_t*);
+Slab* slabCreate(allocator_t*, int);
+void *slabAlloc(allocator_t*, int);
+void slabFree(allocator_t*, Slab*, void*);
+int slabMark(Slab*, void*, int);
+void slabPut(allocator_t*, Slab*, void*);
+void slabRelease(allocator_t*, Slab*);
+int slabTrim(allocator_t*);
+int regionAdd(allocator_t*, size_t);
+Region* regionFor(allocator_t*, void*);
+int heapContains(allocator_t*, void*);
+int blockAt(allocator_t*, void*);
+void *mallocBlock(allocator_t*, size_t);
+void *countMalloc(allocator_t*, void*, size_t);
+void usageTake(allocator_t*, MemoryNode*, size_t);
+void usageGive(allocator_t*, MemoryNode*);
+size_t nodeRequested(allocator_t*, MemoryNode*);
+size_t slabRequest(allocator_t*);
+size_t largestFree(allocator_t*);
+void freeBlock(allocator_t*, void*);
+unsigned long monotonicClock(void);
+void recordEvent(allocator_t*, int, void*, size_t);
+void recordFlush(Recorder*);
+void recordResize(allocator_t*, void*, size_t);
+unsigned char *recordVarint(unsigned char*, unsigned long);
+#ifdef MEMALLOC_HISTOGRAMS
+int histogramBucket(unsigned long);
+unsigned long histogramBucketEnd(int);
+size_t histogramFreeSize(allocator_t*, void*);
+void histogramRecord(allocator_t*, int, size_t, unsigned long);
+void histogramPrint(FILE*, unsigned long*, const char*);
+#endif
+#ifdef MEMALLOC_THREADS
+size_t blockSizeFor(allocator_t*, size_t);
+int cacheClass(size_t);
+size_t cachedBlockSize(void*);
+int threadSlot(void);
+void createThreadSlotKey(void);
+void releaseThreadSlot(void*);
+void *cacheTake(allocator_t*, size_t);
+void cacheReuse(allocator_t*, void*, size_t);
+int markFreed(allocator_t*, void*);
+ThreadCache *cacheClaim(allocator_t*);
+void cacheRelease(allocator_t*, ThreadCache*);
+int cachePut(allocator_t*, void*);
+void *cacheTakeObject(allocator_t*, size_t);
+int cachePutObject(allocator_t*, Slab*, void*);
+int cacheDrain(allocator_t*, int);
+int cacheReclaim(allocator_t*);
+#endif
+
+// Globals
+// The allocator behind setup/my_malloc/my_free
+allocator_t *defaultAllocator;
+
+void setup(int malloc_type, size_t mem_size, void* start_of_memory) {
+    if (defaultAllocator != NULL) {
+        allocator_destroy(defaultAllocator);
+    }
+
+    defaultAllocator = allocator_setup(malloc_type, mem_size, start_of_memory);
+}
+
+void *my_malloc(size_t size) {
+    return allocator_malloc(defaultAllocator, size);
+}
+
+void my_free(void *ptr) {
+    allocator_free(defaultAllocator, ptr);
+}
+
+size_t my_malloc_batch(size_t size, size_t n, void **out) {
+    return allocator_malloc_batch(defaultAllocator, size, n, out);
+}
+
+void my_free_batch(void **ptrs, size_t n) {
+    allocator_free_batch(defaultAllocator, ptrs, n);
+}
+
+void *my_calloc(size_t count, size_t size) {
+    return allocator_calloc(defaultAllocator, count, size);
+}
+
+void *my_realloc(void *ptr, size_t size) {
+    return allocator_realloc(defaultAllocator, ptr, size);
+}
+
+void *my_memalign(size_t alignment, size_t size) {
+    return allocator_memalign(defaultAllocator, alignment, size);
+}
+
+void *my_aligned_alloc(size_t alignment, size_t size) {
+    return allocator_memalign(defaultAllocator, alignment, size);
+}
+
+void my_set_growth(size_t increment, size_t ceiling) {
+    allocator_set_growth(defaultAllocator, increment, ceiling, NULL, NULL);
+}
+
+allocator_stats_t my_stats(void) {
+    return allocator_stats(defaultAllocator);
+}
+
+void my_dump_histograms(FILE *out) {
+    allocator_dump_histograms(defaultAllocator, out);
+}
+
+void my_record(int fd) {
+    allocator_record(defaultAllocator, fd);
+}
+
+allocator_t *allocator_setup(int malloc_type, size_t mem_size, void* start_of_memory) {
+    int zeroed = malloc_type & MEMALLOC_ZEROED;
+    malloc_type &= ~MEMALLOC_ZEROED;
+
+    // Skip ahead so the first pointer handed out is aligned
+    size_t headerSize = (malloc_type == BUDDY_SYSTEM || malloc_type == BUDDY_TREE) ? BUDDY_HEADER_SIZE : HEADER_SIZE;
+    size_t lead = -((size_t)start_of_memory + headerSize) & (MEMALLOC_ALIGNMENT - 1);
+    if (lead >= mem_size) {
+        return NULL;
+    }
+
+    // calloc leaves every list, bin, tree and table empty
+    allocator_t *allocator = calloc(1, sizeof(allocator_t));
+    allocator->mallocType = malloc_type;
+    allocator->memSize = mem_size - lead;
+    allocator->memStart = start_of_memory + lead;
+    allocator->memLimit = allocator->memSize;
+    allocator->growTotal = mem_size;
+    allocator->nextFitRover = allocator->memStart;
+    allocator->usage = &allocator->ownUsage;
+
+    allocator->worstFitHeapCapacity = 64;
+    allocator->worstFitHeap = malloc(allocator->worstFitHeapCapacity * sizeof(MemoryNode*));
+
+    if (allocator->mallocType == BUDDY_SYSTEM || allocator->mallocType == BUDDY_TREE) {
+        allocator->slabOrigin = allocator->memStart;
+    } else {
+        allocator->slabOrigin = (void*)((size_t)allocator->memStart & ~(size_t)(SLAB_SIZE - 1));
+    }
+    allocator->slabWindows = ((size_t)(allocator->memStart + allocator->memSize - allocator->slabOrigin) >> SLAB_SHIFT) + 1;
+    allocator->slabTable = calloc(allocator->slabWindows, sizeof(Slab*));
+
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_init(&allocator->lock, NULL);
+#endif
+
+    if (allocator->mallocType == BUDDY_SYSTEM) {
+        buddySetup(allocator);
+        for (MemoryNode *node = allocator->memoryNodes.head; node != NULL; node = node->next) {
+            node->dirty = zeroed ? 0 : node->size;
+        }
+    } else if (allocator->mallocType == BUDDY_TREE) {
+        buddyTreeSetup(allocator);
+    } else {
+        allocator->nodeTableSize = 64;
+        allocator->nodeTableCount = 0;
+        allocator->nodeTable = calloc(allocator->nodeTableSize, sizeof(MemoryNode*));
+
+        // The fit policies start with one free block of size mem_size at address memStart.
+        // Nothing lies to its left, so it counts as having a used left neighbour.
+        MemoryNode *newNode = createNewNode(allocator, allocator->memStart, ROUND_DOWN(allocator->memSize));
+        newNode->dirty = zeroed ? HEADER_SIZE : newNode->size;
+        setFreeTags(newNode->start, newNode->size);
+        nodeTableInsert(allocator, newNode);
+        freeInsert(allocator, newNode);
+    }
+
+    return allocator;
+}
+
+allocator_t *allocator_attach(int fd, size_t mem_size) {
+    // Whoever gets the file lock first sets the heap up while the others wait
+    if (flock(fd, LOCK_EX) != 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        flock(fd, LOCK_UN);
+        return NULL;
+    }
+    int create = st.st_size == 0;
+    size_t regionSize = create ? mem_size : (size_t)st.st_size;
+
+    // The tree is sized for the whole region, which is at least as large as
+    // the memory after it. The memory starts on a page. A region too small to
+    // hold any memory after them leaves the fd empty for the next attempt.
+    size_t treeOffset = (sizeof(SharedHeader) + 15) & ~(size_t)15;
+    size_t memOffset = 0;
+    if (create) {
+        memOffset = (treeOffset + (2ul << (buddyTreeOrderFor(regionSize) - MIN_BUDDY_ORDER)) + 4095) & ~(size_t)4095;
+        if (memOffset >= regionSize || ftruncate(fd, regionSize) != 0) {
+            flock(fd, LOCK_UN);
+            return NULL;
+        }
+    }
+
+    SharedHeader *header = mmap(NULL, regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        if (create && ftruncate(fd, 0) != 0) {
+            printf("[Could not empty the shared heap's fd again]\n");
+        }
+        flock(fd, LOCK_UN);
+        return NULL;
+    }
+
+    if (create) {
+        header->regionSize = regionSize;
+        header->treeOffset = treeOffset;
+        header->memOffset = memOffset;
+        header->memSize = regionSize - memOffset;
+
+        // The lock is shared between processes and survives one of them dying
+        // while it holds it
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&header->lock, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+    } else if (regionSize < sizeof(SharedHeader) || header->magic != SHARED_MAGIC || header->regionSize != regionSize) {
+        munmap(header, regionSize);
+        flock(fd, LOCK_UN);
+        return NULL;
+    }
+
+    // A buddy tree allocator over the region's memory, whose tree is the one
+    // in the region. The creator fills that in from its own.
+    allocator_t *allocator = allocator_setup(BUDDY_TREE, header->memSize, (void*)header + header->memOffset);
+    unsigned char *tree = (void*)header + header->treeOffset;
+    if (create) {
+        memcpy(tree, allocator->buddyTree, 2ul << (allocator->buddyTreeOrder - MIN_BUDDY_ORDER));
+        header->treeOrder = allocator->buddyTreeOrder;
+        header->usage = allocator->ownUsage;
+        header->magic = SHARED_MAGIC;
+    }
+    free(allocator->buddyTree);
+    allocator->buddyTree = tree;
+    allocator->buddyTreeOrder = header->treeOrder;
+    allocator->shared = header;
+    allocator->usage = &header->usage;
+
+    flock(fd, LOCK_UN);
+    return allocator;
+}
+
+size_t allocator_offset(allocator_t *allocator, void *ptr) {
+    return ptr - (void*)allocator->shared;
+}
+
+void *allocator_pointer(allocator_t *allocator, size_t offset) {
+    return (void*)allocator->shared + offset;
+}
+
+// Takes the lock of a shared heap, if allocator is one
+void sharedLock(allocator_t *allocator) {
+    if (allocator->shared == NULL) {
+        return;
+    }
+
+    // The process that held it died, maybe halfway through changing the tree.
+    // Entries that promise too little only hide some free space until they
+    // are next updated, buddyTreeAlloc repairs those that promise too much.
+    if (pthread_mutex_lock(&allocator->shared->lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&allocator->shared->lock);
+    }
+}
+
+void sharedUnlock(allocator_t *allocator) {
+    if (allocator->shared != NULL) {
+        pthread_mutex_unlock(&allocator->shared->lock);
+    }
+}
+
+// Releases all of an allocator's metadata. The memory it managed belongs to the caller.
+void allocator_destroy(allocator_t *allocator) {
+    if (allocator == NULL) {
+        return;
+    }
+
+#ifdef MEMALLOC_THREADS
+    // Other processes can still use a shared heap, so cached blocks go back to it
+    if (allocator->shared != NULL) {
+        for (int slot = 0; slot < MAX_THREADS; slot++) {
+            ThreadCache *cache = allocator->caches[slot].cache;
+            for (int class = 0; cache != NULL && class < CACHE_CLASSES; class++) {
+                while (cache->count[class] > 0) {
+                    releaseBlock(allocator, cache->blocks[class][--cache->count[class]]);
+                }
+            }
+        }
+    }
+#endif
+
+    allocator_record(allocator, -1);
+
+    while (allocator->nodeChunks != NULL) {
+        NodeChunk *chunk = allocator->nodeChunks;
+        allocator->nodeChunks = chunk->next;
+        free(chunk);
+    }
+
+    free(allocator->buddyTable);
+    if (allocator->shared != NULL) {
+        munmap(allocator->shared, allocator->shared->regionSize);
+    } else {
+        free(allocator->buddyTree);
+    }
+    free(allocator->nodeTable);
+
+    free(allocator->worstFitHeap);
+    free(allocator->slabTable);
+
+    while (allocator->regions != NULL) {
+        Region *region = allocator->regions;
+        allocator->regions = region->next;
+        free(region->slabTable);
+        if (region->mapped) {
+            munmap(region, region->size);
+        }
+    }
+
+#ifdef MEMALLOC_THREADS
+    for (int slot = 0; slot < MAX_THREADS; slot++) {
+        free(allocator->caches[slot].cache);
+    }
+    pthread_mutex_destroy(&allocator->lock);
+#endif
+
+    free(allocator);
+}
+
+void *allocator_malloc(allocator_t *allocator, size_t size) {
+#ifdef MEMALLOC_HISTOGRAMS
+    unsigned long start = monotonicClock();
+    void *ptr = countMalloc(allocator, mallocBlock(allocator, size), size);
+    histogramRecord(allocator, HISTOGRAM_MALLOC, size, start);
+    return ptr;
+#else
+    return countMalloc(allocator, mallocBlock(allocator, size), size);
+#endif
+}
+
+// Counts an allocation of size bytes that returned ptr, records it if
+// recording is on, and passes ptr on
+void *countMalloc(allocator_t *allocator, void *ptr, size_t size) {
+    if (allocator == NULL) {
+        return ptr;
+    }
+
+    if (ptr == (void*)-1) {
+        COUNT(allocator->failures, 1);
+    } else {
+        COUNT(allocator->mallocs, 1);
+        if (allocator->recorder != NULL) {
+            recordEvent(allocator, RECORD_MALLOC, ptr, size);
+        }
+    }
+    return ptr;
+}
+
+// allocator_malloc without the counting
+void *mallocBlock(allocator_t *allocator, size_t size) {
+
+    // Anything larger than the memory could never fit, and would overflow the header math
+    if (allocator == NULL || size == 0 || size > allocator->memLimit) {
+        return (void*) -1;
+    }
+
+    if (size < MIN_MALLOC_SIZE && allocator->shared == NULL) {
+#ifdef MEMALLOC_THREADS
+        void *object = cacheTakeObject(allocator, size);
+        if (object != NULL) {
+            return object;
+        }
+
+        pthread_mutex_lock(&allocator->lock);
+        object = slabAlloc(allocator, size);
+        pthread_mutex_unlock(&allocator->lock);
+        return object;
+#else
+        return slabAlloc(allocator, size);
+#endif
+    }
+
+#ifdef MEMALLOC_THREADS
+    void *cached = cacheTake(allocator, size);
+    if (cached != NULL) {
+        return cached;
+    }
+
+    pthread_mutex_lock(&allocator->lock);
+    void *ptr = allocateBlock(allocator, size);
+    if (ptr == (void*)-1 && slabTrim(allocator)) {
+        ptr = allocateBlock(allocator, size);
+    }
+    if (ptr == (void*)-1 && regionAdd(allocator, size)) {
+        ptr = allocateBlock(allocator, size);
+    }
+    pthread_mutex_unlock(&allocator->lock);
+
+    // What the threads have cached might still make room for the request,
+    // and the slab objects among it may leave slabs empty
+    if (ptr == (void*)-1 && cacheReclaim(allocator)) {
+        pthread_mutex_lock(&allocator->lock);
+        ptr = allocateBlock(allocator, size);
+        if (ptr == (void*)-1 && slabTrim(allocator)) {
+            ptr = allocateBlock(allocator, size);
+        }
+        pthread_mutex_unlock(&allocator->lock);
+    }
+
+    return ptr;
+#else
+    // Empty slabs kept for reuse may be what stands in the way of the request,
+    // and failing that the heap may be allowed to grow
+    void *ptr = allocateBlock(allocator, size);
+    if (ptr == (void*)-1 && slabTrim(allocator)) {
+        ptr = allocateBlock(allocator, size);
+    }
+    if (ptr == (void*)-1 && regionAdd(allocator, size)) {
+        ptr = allocateBlock(allocator, size);
+    }
+
+    return ptr;
+#endif
+}
+
+// Allocates size bytes with the allocator's policy, or returns -1
+void *allocateBlock(allocator_t *allocator, size_t size) {
+    size_t fullSize = size + HEADER_SIZE;
+    switch (allocator->mallocType) {
+        case FIRST_FIT: {
+            MemoryNode* freeNode = findFirstfit(allocator, ROUND_UP(fullSize));
+            if (freeNode != NULL) {
+                usageTake(allocator, freeNode, size);
+                return freeNode->start + HEADER_SIZE;
+            } else {
+                return (void*)-1;
+            }
+            break;
+        }
+
+        case BEST_FIT: {
+            MemoryNode* freeNode = findBestFit(allocator, ROUND_UP(fullSize));
+            if (freeNode != NULL) {
+                usageTake(allocator, freeNode, size);
+                return freeNode->start + HEADER_SIZE;
+            } else {
+                return (void*)-1;
+            }
+
+            break;
+        }
+
+        case WORST_FIT: {
+            MemoryNode* freeNode = findWorstFit(allocator, ROUND_UP(fullSize));
+            if (freeNode != NULL) {
+                usageTake(allocator, freeNode, size);
+                return freeNode->start + HEADER_SIZE;
+            } else {
+                return (void*)-1;
+            }
+            break;
+        }
+
+        case NEXT_FIT: {
+            MemoryNode* freeNode = findNextFit(allocator, ROUND_UP(fullSize));
+            if (freeNode != NULL) {
+                usageTake(allocator, freeNode, size);
+                return freeNode->start + HEADER_SIZE;
+            } else {
+                return (void*)-1;
+            }
+            break;
+        }
+
+        case TLSF: {
+            MemoryNode* freeNode = findTlsf(allocator, ROUND_UP(fullSize));
+            if (freeNode != NULL) {
+                usageTake(allocator, freeNode, size);
+                return freeNode->start + HEADER_SIZE;
+            } else {
+                return (void*)-1;
+            }
+            break;
+        }
+
+        case BUDDY_SYSTEM: {
+            MemoryNode* freeNode = buddyAlloc(allocator, size + BUDDY_HEADER_SIZE);
+            if (freeNode != NULL) {
+                usageTake(allocator, freeNode, size);
+                return freeNode->start + BUDDY_HEADER_SIZE;
+            } else {
+                return (void*)-1;
+            }
+            break;
+        }
+
+        case BUDDY_TREE: {
+            void *start = buddyTreeAlloc(allocator, size + BUDDY_HEADER_SIZE, size);
+            if (start != NULL) {
+                return start + BUDDY_HEADER_SIZE;
+            } else {
+                return (void*)-1;
+            }
+            break;
+        }
+    }
+
+    return (void*)-1;
+}
+
+void *allocator_memalign(allocator_t *allocator, size_t alignment, size_t size) {
+    if (allocator == NULL || alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return countMalloc(allocator, (void*) -1, size);
+    }
+
+    // Every block is aligned that much already
+    if (alignment <= MEMALLOC_ALIGNMENT) {
+        return allocator_malloc(allocator, size);
+    }
+
+    if (size == 0 || size > allocator->memLimit || alignment > allocator->memLimit) {
+        return countMalloc(allocator, (void*) -1, size);
+    }
+
+    // Slab objects are only aligned to their own size from their window, so
+    // small requests with a larger alignment get a block of their own
+    if (size < MIN_MALLOC_SIZE) {
+        size = MIN_MALLOC_SIZE;
+    }
+
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_lock(&allocator->lock);
+#endif
+    void *ptr = allocateAlignedBlock(allocator, size, alignment);
+    if (ptr == (void*)-1 && slabTrim(allocator)) {
+        ptr = allocateAlignedBlock(allocator, size, alignment);
+    }
+    if (ptr == (void*)-1 && regionAdd(allocator, size + alignment + MIN_BLOCK_SIZE)) {
+        ptr = allocateAlignedBlock(allocator, size, alignment);
+    }
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_unlock(&allocator->lock);
+
+    if (ptr == (void*)-1 && cacheReclaim(allocator)) {
+        pthread_mutex_lock(&allocator->lock);
+        ptr = allocateAlignedBlock(allocator, size, alignment);
+        pthread_mutex_unlock(&allocator->lock);
+    }
+#endif
+
+    return countMalloc(allocator, ptr, size);
+}
+
+// Allocates size bytes aligned to alignment with the allocator's policy, or returns -1
+void *allocateAlignedBlock(allocator_t *allocator, size_t size, size_t alignment) {
+    if (allocator->mallocType == BUDDY_SYSTEM || allocator->mallocType == BUDDY_TREE) {
+        return buddyAllocAligned(allocator, size, alignment);
+    }
+
+    return allocateAligned(allocator, size, alignment);
+}
+
+void allocator_free(allocator_t *allocator, void *ptr) {
+#ifdef MEMALLOC_HISTOGRAMS
+    size_t size = histogramFreeSize(allocator, ptr);
+    unsigned long start = monotonicClock();
+    freeBlock(allocator, ptr);
+    histogramRecord(allocator, HISTOGRAM_FREE, size, start);
+#else
+    freeBlock(allocator, ptr);
+#endif
+}
+
+// allocator_free without the timing
+void freeBlock(allocator_t *allocator, void *ptr) {
+    // Check for invalid pointers
+    // Any frees should always be within our given memory space: [memStart..memStart+memSize]
+    // or one of the regions added since
+    if (allocator == NULL || ptr == NULL || !heapContains(allocator, ptr)) {
+        printf("[Trying to free an invalid pointer]\n");
+        return;
+    }
+    COUNT(allocator->frees, 1);
+    if (allocator->recorder != NULL) {
+        recordEvent(allocator, RECORD_FREE, ptr, 0);
+    }
+
+    // A slab can't go away while one of its objects is still allocated, so
+    // looking it up needs no lock
+    Slab *slab = slabFor(allocator, ptr);
+    if (slab != NULL) {
+#ifdef MEMALLOC_THREADS
+        if (cachePutObject(allocator, slab, ptr)) {
+            return;
+        }
+
+        pthread_mutex_lock(&allocator->lock);
+        slabFree(allocator, slab, ptr);
+        pthread_mutex_unlock(&allocator->lock);
+#else
+        slabFree(allocator, slab, ptr);
+#endif
+        return;
+    }
+
+#ifdef MEMALLOC_THREADS
+    if (!markFreed(allocator, ptr) || cachePut(allocator, ptr)) {
+        return;
+    }
+
+    pthread_mutex_lock(&allocator->lock);
+    releaseBlock(allocator, ptr);
+    pthread_mutex_unlock(&allocator->lock);
+#else
+    releaseBlock(allocator, ptr);
+#endif
+}
+
+size_t allocator_malloc_batch(allocator_t *allocator, size_t size, size_t n, void **out) {
+    size_t done = 0;
+
+    if (allocator != NULL && size > 0 && size <= allocator->memLimit) {
+#ifdef MEMALLOC_THREADS
+        pthread_mutex_lock(&allocator->lock);
+#endif
+        done = allocateBatch(allocator, size, n, out);
+        if (done < n && slabTrim(allocator)) {
+            done += allocateBatch(allocator, size, n - done, out + done);
+        }
+
+        // Each region added is sized for all the blocks still missing
+        while (done < n && size >= MIN_MALLOC_SIZE && n - done <= allocator->memLimit / size
+            && regionAdd(allocator, ROUND_UP(size + HEADER_SIZE) * (n - done))) {
+            done += allocateBatch(allocator, size, n - done, out + done);
+        }
+#ifdef MEMALLOC_THREADS
+        pthread_mutex_unlock(&allocator->lock);
+
+        if (done < n && cacheReclaim(allocator)) {
+            pthread_mutex_lock(&allocator->lock);
+            done += allocateBatch(allocator, size, n - done, out + done);
+            pthread_mutex_unlock(&allocator->lock);
+        }
+#endif
+    }
+
+    if (allocator != NULL) {
+        COUNT(allocator->mallocs, done);
+        COUNT(allocator->failures, n - done);
+        for (size_t i = 0; i < done && allocator->recorder != NULL; i++) {
+            recordEvent(allocator, RECORD_MALLOC, out[i], size);
+        }
+    }
+    for (size_t i = done; i < n; i++) {
+        out[i] = (void*)-1;
+    }
+    return done;
+}
+
+// Allocates up to n blocks of size bytes into out and returns how many it got.
+// The fit policies search for a hole that holds a whole run of blocks and cut
+// it up, halving the run whenever no hole is big enough.
+size_t allocateBatch(allocator_t *allocator, size_t size, size_t n, void **out) {
+    size_t done = 0;
+
+    if (size < MIN_MALLOC_SIZE || allocator->mallocType == BUDDY_SYSTEM || allocator->mallocType == BUDDY_TREE) {
+        // Buddy splits push the upper half first on its free list, so
+        // consecutive blocks come out of the same larger block anyway
+        while (done < n) {
+            void *ptr = (size < MIN_MALLOC_SIZE && allocator->shared == NULL) ? slabAlloc(allocator, size) : allocateBlock(allocator, size);
+            if (ptr == (void*)-1) {
+                break;
+            }
+            out[done++] = ptr;
+        }
+        return done;
+    }
+
+    size_t fullSize = ROUND_UP(size + HEADER_SIZE);
+    size_t run = n;
+    while (done < n) {
+        if (run > n - done) {
+            run = n - done;
+        }
+
+        MemoryNode *node = (run <= allocator->memLimit / fullSize) ? findFreeNode(allocator, run * fullSize) : NULL;
+        if (node == NULL) {
+            if (run == 1) {
+                break;
+            }
+            run /= 2;
+            continue;
+        }
+
+        for (size_t i = 1; i < run; i++) {
+            MemoryNode *rest = carve(allocator, node, fullSize);
+            usageTake(allocator, node, size);
+            out[done++] = node->start + HEADER_SIZE;
+            node = rest;
+        }
+        usageTake(allocator, node, size);
+        out[done++] = node->start + HEADER_SIZE;
+    }
+
+    return done;
+}
+
+void allocator_free_batch(allocator_t *allocator, void **ptrs, size_t n) {
+    if (allocator == NULL || n == 0) {
+        return;
+    }
+
+    // In address order, blocks that lie next to each other are next to each
+    // other in the batch, and the fit policies can coalesce them in one go
+    void **sorted = malloc(n * sizeof(void*));
+    memcpy(sorted, ptrs, n * sizeof(void*));
+    qsort(sorted, n, sizeof(void*), compareAddresses);
+
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_lock(&allocator->lock);
+#endif
+    for (size_t i = 0; i < n; ) {
+        void *ptr = sorted[i++];
+        if (ptr == NULL || !heapContains(allocator, ptr)) {
+            printf("[Trying to free an invalid pointer]\n");
+            continue;
+        }
+        COUNT(allocator->frees, 1);
+        if (allocator->recorder != NULL) {
+            recordEvent(allocator, RECORD_FREE, ptr, 0);
+        }
+
+        Slab *slab = slabFor(allocator, ptr);
+        if (slab != NULL) {
+            slabFree(allocator, slab, ptr);
+            continue;
+        }
+
+#ifdef MEMALLOC_THREADS
+        // It may sit in a thread cache already
+        if (!markFreed(allocator, ptr)) {
+            continue;
+        }
+#endif
+
+        if (allocator->mallocType == BUDDY_SYSTEM || allocator->mallocType == BUDDY_TREE) {
+            releaseBlock(allocator, ptr);
+            continue;
+        }
+
+        MemoryNode *node = nodeTableFind(allocator, ptr - HEADER_SIZE);
+        if (node == NULL || node->used == 0) {
+            continue;
+        }
+        usageGive(allocator, node);
+
+        // Fold every used block right behind it that is being freed too into
+        // it, so the whole run is merged with its neighbours once
+        while (i < n && sorted[i] == node->start + node->size + HEADER_SIZE && slabFor(allocator, sorted[i]) == NULL) {
+            MemoryNode *next = nodeTableFind(allocator, node->start + node->size);
+            if (next == NULL || next->used == 0) {
+                break;
+            }
+
+            COUNT(allocator->frees, 1);
+            if (allocator->recorder != NULL) {
+                recordEvent(allocator, RECORD_FREE, sorted[i], 0);
+            }
+            usageGive(allocator, next);
+            nodeTableDelete(allocator, next);
+            node->size += next->size;
+            releaseNode(allocator, next);
+            i++;
+        }
+
+        merge(allocator, node);
+    }
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_unlock(&allocator->lock);
+#endif
+
+    free(sorted);
+}
+
+int compareAddresses(const void *a, const void *b) {
+    void *left = *(void**)a;
+    void *right = *(void**)b;
+    return (left > right) - (left < right);
+}
+
+void *allocator_calloc(allocator_t *allocator, size_t count, size_t size) {
+    if (allocator == NULL || count == 0 || size == 0 || count > allocator->memLimit / size) {
+        return countMalloc(allocator, (void*) -1, size);
+    }
+
+    size = count * size;
+    if (size < MIN_MALLOC_SIZE) {
+        void *object = allocator_malloc(allocator, size);
+        if (object != (void*)-1) {
+            memset(object, 0, size);
+        }
+        return object;
+    }
+
+    // Blocks from the thread caches have been used, so go to the policy
+    // directly, which knows how much of its block is still zero
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_lock(&allocator->lock);
+#endif
+    void *ptr = allocateBlock(allocator, size);
+    if (ptr == (void*)-1 && slabTrim(allocator)) {
+        ptr = allocateBlock(allocator, size);
+    }
+    if (ptr == (void*)-1 && regionAdd(allocator, size)) {
+        ptr = allocateBlock(allocator, size);
+    }
+    size_t dirty = (ptr == (void*)-1) ? size : dirtyBytes(allocator, ptr);
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_unlock(&allocator->lock);
+
+    if (ptr == (void*)-1) {
+        ptr = mallocBlock(allocator, size);
+    }
+#endif
+    if (ptr == (void*)-1) {
+        return countMalloc(allocator, ptr, size);
+    }
+
+    memset(ptr, 0, dirty < size ? dirty : size);
+    return countMalloc(allocator, ptr, size);
+}
+
+// How many bytes from ptr on, at the start of a block the policy just handed
+// out, may not be zero
+size_t dirtyBytes(allocator_t *allocator, void *ptr) {
+    // The buddy tree doesn't know what is zero, so all of its block may not be
+    if (allocator->mallocType == BUDDY_TREE) {
+        return TAG_SIZE(*(size_t*)(ptr - HEADER_SIZE)) - BUDDY_HEADER_SIZE;
+    }
+
+    MemoryNode *node;
+    size_t headerSize;
+    if (allocator->mallocType == BUDDY_SYSTEM) {
+        node = allocator->buddyTable[(ptr - BUDDY_HEADER_SIZE - allocator->memStart) >> MIN_BUDDY_ORDER];
+        headerSize = BUDDY_HEADER_SIZE;
+    } else {
+        node = nodeTableFind(allocator, ptr - HEADER_SIZE);
+        headerSize = HEADER_SIZE;
+    }
+
+    return (node->dirty > headerSize) ? node->dirty - headerSize : 0;
+}
+
+void *allocator_realloc(allocator_t *allocator, void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return allocator_malloc(allocator, size);
+    }
+
+    if (allocator == NULL || !heapContains(allocator, ptr)) {
+        printf("[Trying to realloc an invalid pointer]\n");
+        return (void*) -1;
+    }
+
+    if (size == 0) {
+        allocator_free(allocator, ptr);
+        return NULL;
+    }
+
+    if (size > allocator->memLimit) {
+        return (void*) -1;
+    }
+
+    // Slab objects can't change size, they only move when they get too small
+    size_t usable;
+    Slab *slab = slabFor(allocator, ptr);
+    if (slab != NULL) {
+        usable = slab->objectSize;
+        if (size <= usable) {
+            recordResize(allocator, ptr, size);
+            return ptr;
+        }
+    } else {
+#ifdef MEMALLOC_THREADS
+        pthread_mutex_lock(&allocator->lock);
+        int resized = resizeBlock(allocator, ptr, size, &usable);
+        pthread_mutex_unlock(&allocator->lock);
+#else
+        int resized = resizeBlock(allocator, ptr, size, &usable);
+#endif
+        if (resized) {
+            recordResize(allocator, ptr, size);
+            return ptr;
+        }
+        if (usable == 0) {
+            printf("[Trying to realloc an invalid pointer]\n");
+            return (void*) -1;
+        }
+    }
+
+    // Moving is the last resort
+    void *newPtr = allocator_malloc(allocator, size);
+    if (newPtr == (void*)-1) {
+        return newPtr;
+    }
+
+    memcpy(newPtr, ptr, usable < size ? usable : size);
+    allocator_free(allocator, ptr);
+    return newPtr;
+}
+
+// Grows or shrinks the block at ptr to hold size bytes without moving it.
+// Returns 1 if it did. Otherwise it returns 0 and sets usable to how many
+// bytes the block holds, or to 0 if ptr is not an allocated block.
+int resizeBlock(allocator_t *allocator, void *ptr, size_t size, size_t *usable) {
+    *usable = 0;
+
+    switch (allocator->mallocType) {
+        case FIRST_FIT:
+        case BEST_FIT:
+        case WORST_FIT:
+        case NEXT_FIT:
+        case TLSF: {
+            MemoryNode *node = nodeTableFind(allocator, ptr - HEADER_SIZE);
+            if (node == NULL || node->used == 0) {
+                return 0;
+            }
+            size_t requested = nodeRequested(allocator, node);
+            usageGive(allocator, node);
+
+            // Take in the free block to the right if the two together are big enough
+            size_t fullSize = ROUND_UP(size + HEADER_SIZE);
+            void *nextStart = node->start + node->size;
+            if (fullSize > node->size && blockAt(allocator, nextStart)
+                && (*(size_t*)nextStart & TAG_USED) == 0 && node->size + TAG_SIZE(*(size_t*)nextStart) >= fullSize) {
+                MemoryNode *next = nodeTableFind(allocator, nextStart);
+                freeDelete(allocator, next);
+                nodeTableDelete(allocator, next);
+                node->size += next->size;
+                releaseNode(allocator, next);
+
+                size_t *header = node->start;
+                *header = node->size | TAG_USED | (*header & TAG_PREV_USED);
+                setPrevUsed(allocator, node->start + node->size, 1);
+            }
+
+            if (fullSize > node->size) {
+                usageTake(allocator, node, requested);
+                *usable = node->size - HEADER_SIZE;
+                return 0;
+            }
+
+            // Give back the tail, merging it with whatever is free behind it
+            if (node->size - fullSize >= MIN_BLOCK_SIZE) {
+                merge(allocator, carve(allocator, node, fullSize));
+            }
+            usageTake(allocator, node, size);
+            return 1;
+        }
+
+        case BUDDY_SYSTEM:
+        case BUDDY_TREE: {
+            size_t tag = *(size_t*)(ptr - HEADER_SIZE);
+            void *start = (tag & TAG_ALIGNED) ? ptr - TAG_SIZE(tag) : ptr - BUDDY_HEADER_SIZE;
+            size_t offset = start - allocator->memStart;
+            if (offset % (1 << MIN_BUDDY_ORDER) != 0) {
+                return 0;
+            }
+
+            // Buddy tree blocks don't change size, they only move when they get too small
+            if (allocator->mallocType == BUDDY_TREE) {
+                size_t index = buddyTreeFind(allocator, offset);
+                if (index == 0) {
+                    return 0;
+                }
+                *usable = start + (1ul << buddyTreeOrderOf(allocator, index)) - ptr;
+                if (size > *usable) {
+                    return 0;
+                }
+
+                // What was asked for is kept in the spare start of the header
+                sharedLock(allocator);
+                COUNT(allocator->usage->requestedBytes, size - *(size_t*)start);
+                *(size_t*)start = size;
+                sharedUnlock(allocator);
+                return 1;
+            }
+
+            MemoryNode *node = allocator->buddyTable[offset >> MIN_BUDDY_ORDER];
+            if (node == NULL || node->used == 0) {
+                return 0;
+            }
+
+            // Aligned blocks stay where they are as long as they are big enough
+            if (tag & TAG_ALIGNED) {
+                *usable = node->start + node->size - ptr;
+                if (size > *usable) {
+                    return 0;
+                }
+                usageGive(allocator, node);
+                usageTake(allocator, node, size);
+                return 1;
+            }
+
+            size_t requested = nodeRequested(allocator, node);
+            usageGive(allocator, node);
+            if (buddyResize(allocator, node, size + BUDDY_HEADER_SIZE)) {
+                usageTake(allocator, node, size);
+                return 1;
+            }
+            usageTake(allocator, node, requested);
+            *usable = node->size - BUDDY_HEADER_SIZE;
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+// Gives the block at ptr back to the allocator's policy
+void releaseBlock(allocator_t *allocator, void *ptr) {
+    switch (allocator->mallocType) {
+        case FIRST_FIT:
+        case BEST_FIT:
+        case WORST_FIT:
+        case NEXT_FIT:
+        case TLSF: {
+            // Find the node being freed and merge it with any adjacent free nodes.
+            MemoryNode *nodeToFree = nodeTableFind(allocator, ptr - HEADER_SIZE);
+            if (nodeToFree != NULL && nodeToFree->used == 1) {
+                usageGive(allocator, nodeToFree);
+                merge(allocator, nodeToFree);
+            }
+            break;
+        }
+
+        case BUDDY_SYSTEM:
+        case BUDDY_TREE: {
+            void *start = ptr - BUDDY_HEADER_SIZE;
+            size_t tag = *(size_t*)(ptr - HEADER_SIZE);
+            if (tag & TAG_ALIGNED) {
+                start = ptr - TAG_SIZE(tag);
+            }
+
+            // Every block starts on a multiple of the smallest block size,
+            // anything else was never returned by my_malloc
+            size_t offset = start - allocator->memStart;
+            if (offset % (1 << MIN_BUDDY_ORDER) != 0) {
+                break;
+            }
+
+            if (allocator->mallocType == BUDDY_TREE) {
+                size_t index = buddyTreeFind(allocator, offset);
+                if (index != 0) {
+                    buddyTreeFree(allocator, index);
+                }
+                break;
+            }
+
+            MemoryNode *nodeToFree = allocator->buddyTable[offset >> MIN_BUDDY_ORDER];
+            if (nodeToFree != NULL && nodeToFree->used == 1) {
+                usageGive(allocator, nodeToFree);
+                buddyFree(allocator, nodeToFree);
+            }
+
+            break;
+        }
+    }
+
+}
+
+// Finds and takes a hole of size bytes with one of the fit policies
+MemoryNode* findFreeNode(allocator_t* allocator, size_t size) {
+    switch (allocator->mallocType) {
+        case FIRST_FIT:
+            return findFirstfit(allocator, size);
+        case BEST_FIT:
+            return findBestFit(allocator, size);
+        case WORST_FIT:
+            return findWorstFit(allocator, size);
+        case NEXT_FIT:
+            return findNextFit(allocator, size);
+        case TLSF:
+            return findTlsf(allocator, size);
+    }
+
+    return NULL;
+}
+
+// Cuts the used block node in two at offset and returns the used block after the cut
+MemoryNode* carve(allocator_t* allocator, MemoryNode* node, size_t offset) {
+    MemoryNode *rest = createNewNode(allocator, node->start + offset, node->size - offset);
+    rest->used = 1;
+    *(size_t*)rest->start = rest->size | TAG_USED | TAG_PREV_USED;
+    nodeTableInsert(allocator, rest);
+
+    size_t *header = node->start;
+    node->size = offset;
+    *header = offset | TAG_USED | (*header & TAG_PREV_USED);
+
+    return rest;
+}
+
+// Allocates size bytes at an address that is a multiple of alignment, or
+// returns -1. Only for the fit policies and alignments that are multiples of
+// MEMALLOC_ALIGNMENT. It takes a hole big enough to contain an aligned block,
+// then gives back the space in front of the block and behind it.
+void *allocateAligned(allocator_t *allocator, size_t size, size_t alignment) {
+    size_t fullSize = ROUND_UP(size + HEADER_SIZE);
+    MemoryNode *node = findFreeNode(allocator, fullSize + alignment + MIN_BLOCK_SIZE);
+    if (node == NULL) {
+        return (void*)-1;
+    }
+
+    // The space in front has to be big enough to be a free block of its own
+    size_t address = (size_t)(node->start + HEADER_SIZE);
+    size_t lead = (alignment - address % alignment) % alignment;
+    if (lead > 0 && lead < MIN_BLOCK_SIZE) {
+        lead += alignment;
+    }
+
+    if (lead > 0) {
+        MemoryNode *rest = carve(allocator, node, lead);
+        merge(allocator, node);
+        node = rest;
+    }
+
+    if (node->size - fullSize >= MIN_BLOCK_SIZE) {
+        merge(allocator, carve(allocator, node, fullSize));
+    }
+
+    usageTake(allocator, node, size);
+    return node->start + HEADER_SIZE;
+}
+
+// Slab class for a small request: the smallest power of two object that holds it
+int slabClass(int size) {
+    int shift = (size <= 1) ? 0 : 32 - __builtin_clz(size - 1);
+    return (shift < MIN_SLAB_OBJECT_SHIFT) ? 0 : shift - MIN_SLAB_OBJECT_SHIFT;
+}
+
+// The slab ptr points into, or NULL if ptr is not in a slab. That is the
+// slab starting in ptr's window if it starts at or before ptr, otherwise the
+// one starting in the window before, if it reaches ptr. Both windows are
+// looked up in the table of the memory or region holding ptr: a slab never
+// crosses into another one, and the window before a region's first slab can
+// lie below the region. Only the addresses are compared, so a slab released
+// meanwhile is never read.
+Slab* slabFor(allocator_t *allocator, void *ptr) {
+    size_t window;
+    Slab **table = slabTableFor(allocator, ptr, &window);
+    if (table == NULL) {
+        return NULL;
+    }
+
+    Slab *slab = slabLoad(&table[window]);
+    if ((slab == NULL || ptr < (void*)slab) && window > 0) {
+        slab = slabLoad(&table[window - 1]);
+    }
+
+    if (slab == NULL || ptr < (void*)slab || ptr >= (void*)slab + slabRequest(allocator)) {
+        return NULL;
+    }
+    return slab;
+}
+
+// A slab table entry
+Slab* slabLoad(Slab **slot) {
+#ifdef MEMALLOC_THREADS
+    // Frees look slabs up without the lock
+    return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+#else
+    return *slot;
+#endif
+}
+
+// Records slab, or NULL, as the slab starting in ptr's window
+void slabSet(allocator_t *allocator, void *ptr, Slab *slab) {
+    size_t window;
+    Slab **table = slabTableFor(allocator, ptr, &window);
+#ifdef MEMALLOC_THREADS
+    __atomic_store_n(&table[window], slab, __ATOMIC_RELEASE);
+#else
+    table[window] = slab;
+#endif
+}
+
+// The slab table of the memory or region holding ptr, with ptr's window in
+// it, or NULL if ptr is in neither
+Slab** slabTableFor(allocator_t *allocator, void *ptr, size_t *window) {
+    *window = (size_t)(ptr - allocator->slabOrigin) >> SLAB_SHIFT;
+    if (*window < allocator->slabWindows) {
+        return allocator->slabTable;
+    }
+
+    Region *region = regionFor(allocator, ptr);
+    if (region == NULL) {
+        return NULL;
+    }
+    *window = (size_t)(ptr - region->slabOrigin) >> SLAB_SHIFT;
+    return region->slabTable;
+}
+
+// How many bytes a slab asks its policy for
+size_t slabRequest(allocator_t *allocator) {
+    if (allocator->mallocType == BUDDY_SYSTEM || allocator->mallocType == BUDDY_TREE) {
+        return SLAB_SIZE - BUDDY_HEADER_SIZE;
+    }
+    return SLAB_SIZE;
+}
+
+// Takes a new slab for class from the allocator's policy. Any hole that fits
+// the block will do, slabTable only needs to know which window it starts in.
+Slab* slabCreate(allocator_t *allocator, int class) {
+    void *ptr = allocateBlock(allocator, slabRequest(allocator));
+    if (ptr == (void*)-1 && regionAdd(allocator, slabRequest(allocator))) {
+        ptr = allocateBlock(allocator, slabRequest(allocator));
+    }
+    if (ptr == (void*)-1) {
+        return NULL;
+    }
+
+    // The slab's block is in use, but only the objects handed out from it
+    // count as asked for
+    COUNT(allocator->usage->requestedBytes, -slabRequest(allocator));
+
+    // Regions' windows are aligned like the memory's, so this holds for them too
+    void *base = ptr - ((size_t)(ptr - allocator->slabOrigin) & (SLAB_SIZE - 1));
+
+    // Objects are aligned to their own size from the window the slab starts
+    // in, after the slab itself. ptr is already aligned for the Slab.
+    Slab *slab = ptr;
+    slab->block = ptr;
+    slab->objectSize = 1 << (class + MIN_SLAB_OBJECT_SHIFT);
+    int firstOffset = (ptr - base) + sizeof(Slab);
+    firstOffset = (firstOffset + slab->objectSize - 1) & ~(slab->objectSize - 1);
+
+    slab->firstObject = base + firstOffset;
+    slab->unused = slab->firstObject;
+    slab->freeObjects = NULL;
+    slab->capacity = (ptr + slabRequest(allocator) - slab->firstObject) / slab->objectSize;
+    slab->freeCount = slab->capacity;
+    memset(slab->handedOut, 0, sizeof(slab->handedOut));
+
+    slab->prev = NULL;
+    slab->next = allocator->slabs[class];
+    if (slab->next != NULL) {
+        slab->next->prev = slab;
+    }
+    allocator->slabs[class] = slab;
+    slabSet(allocator, ptr, slab);
+
+    return slab;
+}
+
+void *slabAlloc(allocator_t *allocator, int size) {
+    int class = slabClass(size < MEMALLOC_ALIGNMENT ? MEMALLOC_ALIGNMENT : size);
+
+    Slab *slab = allocator->slabs[class];
+    if (slab == NULL) {
+        slab = slabCreate(allocator, class);
+        if (slab == NULL) {
+            return (void*)-1;
+        }
+    }
+
+    void *object;
+    if (slab->freeObjects != NULL) {
+        object = slab->freeObjects;
+        slab->freeObjects = *(void**)object;
+    } else {
+        object = slab->unused;
+        slab->unused += slab->objectSize;
+    }
+
+    // A full slab leaves the list until one of its objects is freed
+    slab->freeCount--;
+    if (slab->freeCount == 0) {
+        allocator->slabs[class] = slab->next;
+        if (slab->next != NULL) {
+            slab->next->prev = NULL;
+        }
+        slab->next = NULL;
+    }
+
+    COUNT(allocator->usage->requestedBytes, slab->objectSize);
+    slabMark(slab, object, 1);
+    return object;
+}
+
+void slabFree(allocator_t *allocator, Slab *slab, void *object) {
+    // Only the start of an object is a valid pointer
+    if (object < slab->firstObject || object >= slab->unused || (object - slab->firstObject) % slab->objectSize != 0) {
+        printf("[Trying to free an invalid pointer]\n");
+        return;
+    }
+
+    // Like a fit policy block that is free already, an object freed before is left alone
+    if (slabMark(slab, object, 0)) {
+        slabPut(allocator, slab, object);
+    }
+}
+
+// Sets or clears the bit of the object at object, which has to be the start
+// of one. Returns whether it changed, so 0 if object was already handed out
+// or already free.
+int slabMark(Slab *slab, void *object, int handedOut) {
+    size_t index = (object - slab->firstObject) / slab->objectSize;
+    unsigned long *word = &slab->handedOut[index / 64];
+    unsigned long bit = 1ul << (index % 64);
+#ifdef MEMALLOC_THREADS
+    // Thread caches mark objects without the lock, next to others marked under it
+    if (handedOut) {
+        return (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) == 0;
+    }
+    return (__atomic_fetch_and(word, ~bit, __ATOMIC_RELAXED) & bit) != 0;
+#else
+    int was = (*word & bit) != 0;
+    *word = handedOut ? *word | bit : *word & ~bit;
+    return was != handedOut;
+#endif
+}
+
+// Puts an object that is marked free back on its slab
+void slabPut(allocator_t *allocator, Slab *slab, void *object) {
+    int class = slabClass(slab->objectSize);
+    COUNT(allocator->usage->requestedBytes, -slab->objectSize);
+
+    *(void**)object = slab->freeObjects;
+    slab->freeObjects = object;
+
+    // A slab that was full goes back on the list
+    if (slab->freeCount == 0) {
+        slab->prev = NULL;
+        slab->next = allocator->slabs[class];
+        if (slab->next != NULL) {
+            slab->next->prev = slab;
+        }
+        allocator->slabs[class] = slab;
+    }
+    slab->freeCount++;
+
+    // An empty slab goes back to the policy, unless it is the only one left
+    // for its class, so alternating malloc/free doesn't create and destroy slabs
+    if (slab->freeCount == slab->capacity && (slab->prev != NULL || slab->next != NULL)) {
+        slabRelease(allocator, slab);
+    }
+}
+
+// Takes an empty slab off its class list and gives its block back to the policy
+void slabRelease(allocator_t *allocator, Slab *slab) {
+    int class = slabClass(slab->objectSize);
+    if (slab->prev == NULL) {
+        allocator->slabs[class] = slab->next;
+    } else {
+        slab->prev->next = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+
+    slabSet(allocator, slab, NULL);
+    COUNT(allocator->usage->requestedBytes, slabRequest(allocator));
+    releaseBlock(allocator, slab->block);
+}
+
+// Releases the empty slab each class keeps around. Returns whether any was released.
+int slabTrim(allocator_t *allocator) {
+    int released = 0;
+    for (int class = 0; class < SLAB_CLASSES; class++) {
+        Slab *slab = allocator->slabs[class];
+        while (slab != NULL) {
+            Slab *next = slab->next;
+            if (slab->freeCount == slab->capacity) {
+                slabRelease(allocator, slab);
+                released = 1;
+            }
+            slab = next;
+        }
+    }
+
+    return released;
+}
+
+void allocator_set_growth(allocator_t *allocator, size_t increment, size_t ceiling, allocator_grow_t grow, void *context) {
+    if (allocator == NULL || allocator->mallocType == BUDDY_SYSTEM || allocator->mallocType == BUDDY_TREE) {
+        return;
+    }
+
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_lock(&allocator->lock);
+#endif
+    allocator->growIncrement = increment;
+    allocator->growCeiling = ceiling;
+    allocator->grow = grow;
+    allocator->growContext = context;
+    allocator->memLimit = (ceiling > allocator->memSize) ? ceiling : allocator->memSize;
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_unlock(&allocator->lock);
+#endif
+}
+
+// Adds a region big enough for a request of size bytes, growIncrement if that
+// is more, and puts all of it on the free index as one hole. Returns 0 if
+// growing isn't allowed, would go past the ceiling or gets no memory.
+int regionAdd(allocator_t *allocator, size_t size) {
+    if (allocator->growIncrement == 0 || size > allocator->memLimit) {
+        return 0;
+    }
+
+    // The region itself, the header of its first block and the used one at its end
+    size_t overhead = sizeof(Region) + MEMALLOC_ALIGNMENT + HEADER_SIZE;
+    size_t regionSize = ROUND_UP(size + HEADER_SIZE) + overhead;
+    if (regionSize < allocator->growIncrement) {
+        regionSize = allocator->growIncrement;
+    }
+    regionSize = (regionSize + 4095) & ~(size_t)4095;
+
+    // Near the ceiling, whatever is left will do as long as the request fits
+    if (allocator->growTotal + regionSize > allocator->growCeiling) {
+        if (allocator->growTotal + ROUND_UP(size + HEADER_SIZE) + overhead > allocator->growCeiling) {
+            return 0;
+        }
+        regionSize = allocator->growCeiling - allocator->growTotal;
+    }
+
+    void *memory;
+    if (allocator->grow != NULL) {
+        memory = allocator->grow(regionSize, allocator->growContext);
+    } else {
+        memory = mmap(NULL, regionSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        memory = (memory == MAP_FAILED) ? NULL : memory;
+    }
+    if (memory == NULL) {
+        return 0;
+    }
+
+    // Region lives at the start of what it is given, which the callback only
+    // has to align for a pointer
+    Region *region = memory;
+    region->size = regionSize;
+    region->mapped = allocator->grow == NULL;
+
+    // Blocks start HEADER_SIZE in front of an aligned address, like those of
+    // the memory given to setup
+    void *first = (void*)(ROUND_UP((size_t)memory + sizeof(Region) + HEADER_SIZE) - HEADER_SIZE);
+    size_t blocks = ROUND_DOWN((size_t)(memory + regionSize - HEADER_SIZE - first));
+    region->end = first + blocks;
+    *(size_t*)region->end = TAG_USED | TAG_PREV_USED;
+
+    region->slabOrigin = (void*)((size_t)memory & ~(size_t)(SLAB_SIZE - 1));
+    region->slabWindows = ((size_t)(memory + regionSize - region->slabOrigin) >> SLAB_SHIFT) + 1;
+    region->slabTable = calloc(region->slabWindows, sizeof(Slab*));
+
+    region->next = allocator->regions;
+#ifdef MEMALLOC_THREADS
+    // Frees look regions up without the lock, so they may only see it whole
+    __atomic_store_n(&allocator->regions, region, __ATOMIC_RELEASE);
+#else
+    allocator->regions = region;
+#endif
+    allocator->growTotal += regionSize;
+
+    // Fresh memory from mmap is zero apart from the header just written
+    MemoryNode *node = createNewNode(allocator, first, blocks);
+    node->dirty = region->mapped ? HEADER_SIZE : node->size;
+    setFreeTags(node->start, node->size);
+    nodeTableInsert(allocator, node);
+    freeInsert(allocator, node);
+
+    return 1;
+}
+
+// The region added since setup that ptr points into, or NULL
+Region* regionFor(allocator_t *allocator, void *ptr) {
+#ifdef MEMALLOC_THREADS
+    Region *regions = __atomic_load_n(&allocator->regions, __ATOMIC_ACQUIRE);
+#else
+    Region *regions = allocator->regions;
+#endif
+    for (Region *region = regions; region != NULL; region = region->next) {
+        if (ptr >= (void*)region && ptr < region->end) {
+            return region;
+        }
+    }
+    return NULL;
+}
+
+// Whether ptr lies in the memory given to setup or in a region added since
+int heapContains(allocator_t *allocator, void *ptr) {
+    if (ptr >= allocator->memStart && ptr <= allocator->memStart + allocator->memSize) {
+        return 1;
+    }
+    return regionFor(allocator, ptr) != NULL;
+}
+
+// Whether a block can start at start, which is anywhere but the end of the
+// memory given to setup. Regions end with a used header instead.
+int blockAt(allocator_t *allocator, void *start) {
+    return start != allocator->memStart + ROUND_DOWN(allocator->memSize);
+}
+
+allocator_stats_t allocator_stats(allocator_t *allocator) {
+    allocator_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    if (allocator == NULL) {
+        return stats;
+    }
+
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_lock(&allocator->lock);
+#endif
+    sharedLock(allocator);
+    HeapUsage usage = *allocator->usage;
+#ifdef MEMALLOC_THREADS
+    // Thread caches change it without the locks when they hand a block out again
+    usage.requestedBytes = __atomic_load_n(&allocator->usage->requestedBytes, __ATOMIC_RELAXED);
+#endif
+    stats.largestFree = largestFree(allocator);
+    sharedUnlock(allocator);
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_unlock(&allocator->lock);
+#endif
+
+    stats.mallocType = allocator->mallocType;
+    stats.usedBytes = usage.usedBytes;
+    stats.requestedBytes = usage.requestedBytes;
+    stats.wastedBytes = usage.usedBytes - usage.requestedBytes;
+    stats.freeBytes = usage.freeBytes;
+    stats.freeFragments = usage.freeFragments;
+    stats.fragmentation = (usage.freeBytes > 0) ? 1.0 - (double)stats.largestFree / usage.freeBytes : 0.0;
+    stats.mallocs = allocator->mallocs;
+    stats.frees = allocator->frees;
+    stats.failures = allocator->failures;
+    return stats;
+}
+
+// Counts node, which was free, as handed out to a caller who asked for requested bytes
+void usageTake(allocator_t *allocator, MemoryNode *node, size_t requested) {
+#ifdef MEMALLOC_THREADS
+    // Where a thread cache can change it: the spare start of a buddy block's
+    // header, or the top bits of a small fit block's
+    if (allocator->mallocType == BUDDY_SYSTEM) {
+        *(size_t*)node->start = requested;
+    } else if (node->size <= CACHE_MAX_SIZE) {
+        size_t *header = node->start;
+        __atomic_fetch_and(header, (1ul << TAG_REQUESTED_SHIFT) - 1, __ATOMIC_RELAXED);
+        __atomic_fetch_or(header, requested << TAG_REQUESTED_SHIFT, __ATOMIC_RELAXED);
+    }
+#endif
+    node->requested = requested;
+    allocator->usage->usedBytes += node->size;
+    COUNT(allocator->usage->requestedBytes, requested);
+}
+
+// Counts node as no longer handed out, before it is freed or changes size
+void usageGive(allocator_t *allocator, MemoryNode *node) {
+    allocator->usage->usedBytes -= node->size;
+    COUNT(allocator->usage->requestedBytes, -nodeRequested(allocator, node));
+}
+
+// How many bytes the caller of the used block node asked for. A thread cache
+// may have handed the block out again since usageTake.
+size_t nodeRequested(allocator_t *allocator, MemoryNode *node) {
+#ifdef MEMALLOC_THREADS
+    if (allocator->mallocType == BUDDY_SYSTEM) {
+        return *(size_t*)node->start;
+    } else if (node->size <= CACHE_MAX_SIZE) {
+        return TAG_REQUESTED(__atomic_load_n((size_t*)node->start, __ATOMIC_RELAXED));
+    }
+#else
+    (void)allocator;
+#endif
+    return node->requested;
+}
+
+// Size of the largest free block, read off the policy's free index. Only
+// TLSF has to look through one list for it.
+size_t largestFree(allocator_t *allocator) {
+    size_t largest = 0;
+    switch (allocator->mallocType) {
+        case BEST_FIT:
+            for (MemoryNode *node = allocator->bestFitTree; node != NULL; node = node->right) {
+                largest = node->size;
+            }
+            break;
+
+        case WORST_FIT:
+            if (allocator->worstFitHeapSize > 0) {
+                largest = allocator->worstFitHeap[0]->size;
+            }
+            break;
+
+        case FIRST_FIT:
+        case NEXT_FIT:
+            if (allocator->addressTree != NULL) {
+                largest = allocator->addressTree->maxSize;
+            }
+            break;
+
+        case TLSF:
+            if (allocator->tlsfFlMap != 0) {
+                int fl = 63 - __builtin_clzl(allocator->tlsfFlMap);
+                int sl = 31 - __builtin_clz(allocator->tlsfSlMap[fl]);
+                for (MemoryNode *node = allocator->tlsfLists[fl][sl]; node != NULL; node = node->binNext) {
+                    largest = (node->size > largest) ? node->size : largest;
+                }
+            }
+            break;
+
+        case BUDDY_SYSTEM:
+            if (allocator->freeBinMap != 0) {
+                largest = 1ul << (63 - __builtin_clzl(allocator->freeBinMap));
+            }
+            break;
+
+        case BUDDY_TREE:
+            if (allocator->buddyTree[1] != 0) {
+                largest = 1ul << (allocator->buddyTree[1] - 1);
+            }
+            break;
+    }
+
+    return largest;
+}
+
+void allocator_dump_histograms(allocator_t *allocator, FILE *out) {
+#ifdef MEMALLOC_HISTOGRAMS
+    if (allocator == NULL) {
+        return;
+    }
+
+    const char *names[HISTOGRAM_OPS] = {"MALLOC", "FREE"};
+    for (int op = 0; op < HISTOGRAM_OPS; op++) {
+        unsigned long total[HISTOGRAM_BUCKETS] = {0};
+        for (int class = 0; class < NUM_BINS; class++) {
+            for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+                total[bucket] += allocator->histograms[op][class][bucket];
+            }
+        }
+
+        char label[64];
+        snprintf(label, sizeof(label), "[%s]", names[op]);
+        histogramPrint(out, total, label);
+        for (int class = 0; class < NUM_BINS; class++) {
+            snprintf(label, sizeof(label), "\t[size %lu-%lu]", 1ul << class, (2ul << class) - 1);
+            histogramPrint(out, allocator->histograms[op][class], label);
+        }
+    }
+#else
+    (void)allocator;
+    (void)out;
+#endif
+}
+
+unsigned long monotonicClock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+// Thread numbers for record mode, handed out from 1 on as threads first record
+unsigned int recordThreads;
+__thread unsigned int recordThread;
+
+void allocator_record(allocator_t *allocator, int fd) {
+    if (allocator == NULL) {
+        return;
+    }
+
+    Recorder *recorder = allocator->recorder;
+    if (recorder != NULL) {
+        allocator->recorder = NULL;
+        recordFlush(recorder);
+#ifdef MEMALLOC_THREADS
+        pthread_mutex_destroy(&recorder->lock);
+#endif
+        free(recorder);
+    }
+
+    if (fd < 0) {
+        return;
+    }
+
+    recorder = malloc(sizeof(Recorder));
+    recorder->fd = fd;
+    recorder->lastTime = monotonicClock();
+    memcpy(recorder->buffer, RECORD_MAGIC, strlen(RECORD_MAGIC));
+    recorder->used = strlen(RECORD_MAGIC);
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_init(&recorder->lock, NULL);
+#endif
+    allocator->recorder = recorder;
+}
+
+// Appends an op event for the block at ptr of size bytes to the log
+void recordEvent(allocator_t *allocator, int op, void *ptr, size_t size) {
+    Recorder *recorder = allocator->recorder;
+    if (recordThread == 0) {
+        recordThread = __atomic_add_fetch(&recordThreads, 1, __ATOMIC_RELAXED);
+    }
+    // Every block lies the same distance past a multiple of MEMALLOC_ALIGNMENT
+    // from memStart, so rounding down keeps the objects apart
+    long offset = (ptr - allocator->memStart) >> __builtin_ctz(MEMALLOC_ALIGNMENT);
+
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_lock(&recorder->lock);
+#endif
+    // Read under the lock, so the times of the events only ever go up
+    unsigned long time = monotonicClock();
+    unsigned char *out = recorder->buffer + recorder->used;
+    out = recordVarint(out, ((time - recorder->lastTime) << 1) | op);
+    out = recordVarint(out, recordThread);
+    out = recordVarint(out, ((unsigned long)offset << 1) ^ (unsigned long)(offset >> 63));
+    if (op == RECORD_MALLOC) {
+        out = recordVarint(out, size);
+    }
+    recorder->lastTime = time;
+    recorder->used = out - recorder->buffer;
+
+    if (recorder->used > RECORD_BUFFER_SIZE - RECORD_EVENT_MAX) {
+        recordFlush(recorder);
+    }
+#ifdef MEMALLOC_THREADS
+    pthread_mutex_unlock(&recorder->lock);
+#endif
+}
+
+// A block resized in place is recorded as freed and allocated again
+void recordResize(allocator_t *allocator, void *ptr, size_t size) {
+    if (allocator->recorder != NULL) {
+        recordEvent(allocator, RECORD_FREE, ptr, 0);
+        recordEvent(allocator, RECORD_MALLOC, ptr, size);
+    }
+}
+
+// Writes value at out, seven bits at a time from the lowest, and returns
+// where it ends
+unsigned char *recordVarint(unsigned char *out, unsigned long value) {
+    while (value >= 0x80) {
+        *out++ = value | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+// Writes out and empties the buffer
+void recordFlush(Recorder *recorder) {
+    size_t written = 0;
+    while (recorder->fd >= 0 && written < recorder->used) {
+        ssize_t count = write(recorder->fd, recorder->buffer + written, recorder->used - written);
+        if (count < 0 && errno != EINTR) {
+            recorder->fd = -1;
+        }
+        written += (count > 0) ? count : 0;
+    }
+    recorder->used = 0;
+}
+
+#ifdef MEMALLOC_HISTOGRAMS
+// Bucket of a time of ns nanoseconds. Below 4 every nanosecond has a bucket,
+// above that the two bits after the highest pick one of four per power of two.
+int histogramBucket(unsigned long ns) {
+    if (ns < 4) {
+        return ns;
+    }
+
+    int log = 63 - __builtin_clzl(ns);
+    int bucket = (log - 1) * 4 + ((ns >> (log - 2)) & 3);
+    return (bucket < HISTOGRAM_BUCKETS) ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+// The longest time, in nanoseconds, that falls into bucket
+unsigned long histogramBucketEnd(int bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+
+    int log = bucket / 4 + 1;
+    return ((4ul + bucket % 4 + 1) << (log - 2)) - 1;
+}
+
+// Size of the block at ptr that a free is counted under, which is how large
+// the block is rather than what was asked for, or 0 if ptr is not one
+size_t histogramFreeSize(allocator_t *allocator, void *ptr) {
+    if (allocator == NULL || ptr == NULL || !heapContains(allocator, ptr)) {
+        return 0;
+    }
+
+    Slab *slab = slabFor(allocator, ptr);
+    if (slab != NULL) {
+        return slab->objectSize;
+    }
+
+    // Aligned buddy blocks keep their size in the header at their start
+#ifdef MEMALLOC_THREADS
+    // A neighbour can flip TAG_PREV_USED in it under the lock meanwhile
+    size_t tag = __atomic_load_n((size_t*)(ptr - HEADER_SIZE), __ATOMIC_RELAXED);
+#else
+    size_t tag = *(size_t*)(ptr - HEADER_SIZE);
+#endif
+    if (tag & TAG_ALIGNED) {
+        tag = *(size_t*)(ptr - TAG_SIZE(tag) + BUDDY_HEADER_SIZE - HEADER_SIZE);
+    }
+    return TAG_SIZE(tag);
+}
+
+// Counts a call of op for size bytes that started at start
+void histogramRecord(allocator_t *allocator, int op, size_t size, unsigned long start) {
+    unsigned long ns = monotonicClock() - start;
+    if (allocator == NULL) {
+        return;
+    }
+
+    int class = (size > 0) ? sizeClass(size) : 0;
+    COUNT(allocator->histograms[op][class][histogramBucket(ns)], 1);
+}
+
+// Prints the number of calls in histogram and the times that 50%, 99% and
+// 99.9% of them took at most, to the end of their bucket. Empty ones are skipped.
+void histogramPrint(FILE *out, unsigned long *histogram, const char *label) {
+    unsigned long calls = 0;
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        calls += histogram[bucket];
+    }
+    if (calls == 0) {
+        return;
+    }
+
+    const double quantiles[] = {0.5, 0.99, 0.999, 1.0};
+    unsigned long times[4];
+    unsigned long seen = 0;
+    int bucket = 0;
+    for (int q = 0; q < 4; q++) {
+        // The rank of the call that is slower than the given share of them
+        unsigned long rank = (unsigned long)(quantiles[q] * calls);
+        if (rank < quantiles[q] * calls || rank == 0) {
+            rank++;
+        }
+        while (seen + histogram[bucket] < rank) {
+            seen += histogram[bucket++];
+        }
+        times[q] = histogramBucketEnd(bucket);
+    }
+
+    fprintf(out, "%s calls=%lu p50=%luns p99=%luns p999=%luns max=%luns\n", label, calls, times[0], times[1], times[2], times[3]);
+}
+#endif
+
+#ifdef MEMALLOC_THREADS
+// Thread slots. Each thread that allocates gets a small integer, which picks
+// its cache in every allocator. A slot goes back to the pool when its thread
+// exits and the next thread to take it inherits the cached blocks, so they are
+// not stranded.
+pthread_mutex_t threadSlotLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t threadSlotKey;
+pthread_once_t threadSlotOnce = PTHREAD_ONCE_INIT;
+int threadSlotTaken[MAX_THREADS];
+__thread int currentThreadSlot = -1;
+
+void createThreadSlotKey(void) {
+    pthread_key_create(&threadSlotKey, releaseThreadSlot);
+}
+
+// Returns the calling thread's slot, or -1 if every slot is taken
+int threadSlot(void) {
+    if (currentThreadSlot >= 0) {
+        return currentThreadSlot;
+    }
+
+    pthread_once(&threadSlotOnce, createThreadSlotKey);
+
+    pthread_mutex_lock(&threadSlotLock);
+    for (int slot = 0; slot < MAX_THREADS; slot++) {
+        if (!threadSlotTaken[slot]) {
+            threadSlotTaken[slot] = 1;
+            currentThreadSlot = slot;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&threadSlotLock);
+
+    if (currentThreadSlot >= 0) {
+        // The key's value only has to be non-NULL for the destructor to run
+        pthread_setspecific(threadSlotKey, &threadSlotTaken[currentThreadSlot]);
+    }
+
+    return currentThreadSlot;
+}
+
+void releaseThreadSlot(void *taken) {
+    pthread_mutex_lock(&threadSlotLock);
+    *(int*)taken = 0;
+    pthread_mutex_unlock(&threadSlotLock);
+}
+
+// Size of the block my_malloc would carve for a request of size bytes
+size_t blockSizeFor(allocator_t *allocator, size_t size) {
+    if (allocator->mallocType == BUDDY_SYSTEM || allocator->mallocType == BUDDY_TREE) {
+        int order = 64 - __builtin_clzl(size + BUDDY_HEADER_SIZE - 1);
+        return 1ul << (order < MIN_BUDDY_ORDER ? MIN_BUDDY_ORDER : order);
+    }
+
+    return ROUND_UP(size + HEADER_SIZE);
+}
+
+// Size of a block the calling thread holds. Its neighbours can flip the
+// TAG_PREV_USED bit of its header under the lock at any time, so read it atomically.
+size_t cachedBlockSize(void *ptr) {
+    return TAG_SIZE(__atomic_load_n((size_t*)(ptr - HEADER_SIZE), __ATOMIC_RELAXED));
+}
+
+// Cache class of a block: its power of two plus the next two bits below it
+int cacheClass(size_t size) {
+    int bin = sizeClass(size);
+    int quarter = (bin >= 2) ? (size >> (bin - 2)) & 3 : 0;
+    return bin * 4 + quarter;
+}
+
+// Pops a cached block that can hold size bytes, or returns NULL
+void *cacheTake(allocator_t *allocator, size_t size) {
+    size_t fullSize = blockSizeFor(allocator, size);
+    if (fullSize > CACHE_MAX_SIZE) {
+        return NULL;
+    }
+
+    ThreadCache *cache = cacheClaim(allocator);
+    if (cache == NULL) {
+        return NULL;
+    }
+    int class = cacheClass(fullSize);
+    void *ptr = NULL;
+
+    // Blocks in the request's own class may still be a little too small
+    for (int i = cache->count[class] - 1; i >= 0; i--) {
+        if (cachedBlockSize(cache->blocks[class][i]) >= fullSize) {
+            ptr = cache->blocks[class][i];
+            cache->blocks[class][i] = cache->blocks[class][--cache->count[class]];
+            break;
+        }
+    }
+    cacheRelease(allocator, cache);
+
+    if (ptr != NULL) {
+        cacheReuse(allocator, ptr, size);
+    }
+    return ptr;
+}
+
+// Hands ptr, a block just taken from a thread cache, out again to a caller
+// who asked for size bytes. It is still counted for whoever freed it, so only
+// the difference in what was asked for is counted.
+void cacheReuse(allocator_t *allocator, void *ptr, size_t size) {
+    size_t *header = ptr - HEADER_SIZE;
+    size_t requested;
+
+    if (allocator->mallocType == BUDDY_SYSTEM || allocator->mallocType == BUDDY_TREE) {
+        __atomic_fetch_and(header, ~TAG_FREED, __ATOMIC_RELAXED);
+        size_t *spare = ptr - BUDDY_HEADER_SIZE;
+        requested = *spare;
+        *spare = size;
+    } else {
+        // A neighbour can flip TAG_PREV_USED under the lock meanwhile
+        size_t tag = __atomic_load_n(header, __ATOMIC_RELAXED);
+        size_t kept = (1ul << TAG_REQUESTED_SHIFT) - 1 - TAG_FREED;
+        do {
+            requested = TAG_REQUESTED(tag);
+        } while (!__atomic_compare_exchange_n(header, &tag, (tag & kept) | size << TAG_REQUESTED_SHIFT,
+                                              1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+
+    COUNT(allocator->usage->requestedBytes, size - requested);
+}
+
+// Marks the block at ptr as freed, or returns 0 if it is not a used block: it
+// is free already, or was freed before and still sits in a thread cache. These
+// are the checks the lock would allow, made on the header alone.
+int markFreed(allocator_t *allocator, void *ptr) {
+    size_t *header = ptr - HEADER_SIZE;
+    size_t tag = __atomic_load_n(header, __ATOMIC_RELAXED);
+
+    // Aligned buddy blocks don't have their size in front of the pointer,
+    // the lock path checks them
+    if (allocator->mallocType == BUDDY_SYSTEM || allocator->mallocType == BUDDY_TREE) {
+        if (tag & TAG_ALIGNED) {
+            return 1;
+        }
+    } else if ((tag & TAG_USED) == 0) {
+        return 0;
+    }
+
+    return (__atomic_fetch_or(header, TAG_FREED, __ATOMIC_RELAXED) & TAG_FREED) == 0;
+}
+
+// Takes the calling thread's cache for its own use, setting it up on first
+// use. Returns NULL if the thread has no slot or another thread is emptying
+// the cache right now. Give it back with cacheRelease.
+ThreadCache *cacheClaim(allocator_t *allocator) {
+    int slot = threadSlot();
+    if (slot < 0) {
+        return NULL;
+    }
+
+    // No other thread sees a new cache before cacheRelease publishes it
+    CacheSlot *entry = &allocator->caches[slot];
+    if (entry->cache == NULL) {
+        entry->cache = calloc(1, sizeof(ThreadCache));
+        return entry->cache;
+    }
+
+    return __atomic_exchange_n(&entry->held, NULL, __ATOMIC_ACQUIRE);
+}
+
+// Gives back the calling thread's cache, taken with cacheClaim
+void cacheRelease(allocator_t *allocator, ThreadCache *cache) {
+    __atomic_store_n(&allocator->caches[threadSlot()].held, cache, __ATOMIC_RELEASE);
+}
+
+// Keeps a freed block in the calling thread's cache. When its class is full,
+// half of it goes back to the heap under a single lock first. Returns 0 if the
+// block has to be freed normally: the thread's cache is not available, the
+// block is too large or it is an aligned buddy block, which has no size in its
+// header.
+int cachePut(allocator_t *allocator, void *ptr) {
+    size_t tag = __atomic_load_n((size_t*)(ptr - HEADER_SIZE), __ATOMIC_RELAXED);
+    if ((tag & TAG_ALIGNED) || TAG_SIZE(tag) > CACHE_MAX_SIZE) {
+        return 0;
+    }
+
+    ThreadCache *cache = cacheClaim(allocator);
+    if (cache == NULL) {
+        return 0;
+    }
+    int class = cacheClass(TAG_SIZE(tag));
+
+    if (cache->count[class] == CACHE_DEPTH) {
+        pthread_mutex_lock(&allocator->lock);
+        while (cache->count[class] > CACHE_DEPTH / 2) {
+            releaseBlock(allocator, cache->blocks[class][--cache->count[class]]);
+        }
+        pthread_mutex_unlock(&allocator->lock);
+    }
+
+    cache->blocks[class][cache->count[class]++] = ptr;
+    cacheRelease(allocator, cache);
+    return 1;
+}
+
+// Pops a cached slab object for a request of size bytes. An empty class is
+// refilled from the slabs first. Returns NULL if the thread's cache is not
+// available or the slabs have no more objects.
+void *cacheTakeObject(allocator_t *allocator, size_t size) {
+    ThreadCache *cache = cacheClaim(allocator);
+    if (cache == NULL) {
+        return NULL;
+    }
+    int class = slabClass(size < MEMALLOC_ALIGNMENT ? MEMALLOC_ALIGNMENT : size);
+    void *object = NULL;
+
+    if (cache->objectCount[class] == 0) {
+        pthread_mutex_lock(&allocator->lock);
+        while (cache->objectCount[class] < CACHE_OBJECT_DEPTH / 2) {
+            void *refill = slabAlloc(allocator, 1 << (class + MIN_SLAB_OBJECT_SHIFT));
+            if (refill == (void*)-1) {
+                break;
+            }
+            slabMark(slabFor(allocator, refill), refill, 0);
+            cache->objects[class][cache->objectCount[class]++] = refill;
+        }
+        pthread_mutex_unlock(&allocator->lock);
+    }
+    if (cache->objectCount[class] > 0) {
+        object = cache->objects[class][--cache->objectCount[class]];
+        slabMark(slabFor(allocator, object), object, 1);
+    }
+    cacheRelease(allocator, cache);
+
+    return object;
+}
+
+// Keeps a freed slab object in the calling thread's cache. When its class is
+// full, half of it goes back to the slabs under a single lock first. An object
+// that is free already is left alone. Returns 0 if the thread's cache is not
+// available or object is not the start of one.
+int cachePutObject(allocator_t *allocator, Slab *slab, void *object) {
+    if (object < slab->firstObject || (object - slab->firstObject) % slab->objectSize != 0) {
+        return 0;
+    }
+    ThreadCache *cache = cacheClaim(allocator);
+    if (cache == NULL) {
+        return 0;
+    }
+    if (!slabMark(slab, object, 0)) {
+        cacheRelease(allocator, cache);
+        return 1;
+    }
+    int class = slabClass(slab->objectSize);
+
+    if (cache->objectCount[class] == CACHE_OBJECT_DEPTH) {
+        pthread_mutex_lock(&allocator->lock);
+        while (cache->objectCount[class] > CACHE_OBJECT_DEPTH / 2) {
+            void *cached = cache->objects[class][--cache->objectCount[class]];
+            slabPut(allocator, slabFor(allocator, cached), cached);
+        }
+        pthread_mutex_unlock(&allocator->lock);
+    }
+
+    cache->objects[class][cache->objectCount[class]++] = object;
+    cacheRelease(allocator, cache);
+    return 1;
+}
+
+// Returns every block and slab object in the cache of the thread holding slot
+// to the heap. A cache in use right now is left alone, its thread holds on to
+// what is in it anyway. Returns whether there was anything.
+int cacheDrain(allocator_t *allocator, int slot) {
+    CacheSlot *entry = &allocator->caches[slot];
+    ThreadCache *cache = __atomic_exchange_n(&entry->held, NULL, __ATOMIC_ACQUIRE);
+    if (cache == NULL) {
+        return 0;
+    }
+    int drained = 0;
+
+    pthread_mutex_lock(&allocator->lock);
+    for (int class = 0; class < CACHE_CLASSES; class++) {
+        while (cache->count[class] > 0) {
+            releaseBlock(allocator, cache->blocks[class][--cache->count[class]]);
+            drained = 1;
+        }
+    }
+    for (int class = 0; class < SLAB_CLASSES; class++) {
+        while (cache->objectCount[class] > 0) {
+            void *object = cache->objects[class][--cache->objectCount[class]];
+            slabPut(allocator, slabFor(allocator, object), object);
+            drained = 1;
+        }
+    }
+    pthread_mutex_unlock(&allocator->lock);
+
+    __atomic_store_n(&entry->held, cache, __ATOMIC_RELEASE);
+    return drained;
+}
+
+// Returns the blocks of every thread's cache to the heap, for a request that
+// failed without them. Returns whether there were any.
+int cacheReclaim(allocator_t *allocator) {
+    int drained = 0;
+    for (int slot = 0; slot < MAX_THREADS; slot++) {
+        if (cacheDrain(allocator, slot)) {
+            drained = 1;
+        }
+    }
+
+    return drained;
+}
+#endif
+
+// Returns every block the calling thread has cached for allocator to the heap
+void allocator_thread_flush(allocator_t *allocator) {
+#ifdef MEMALLOC_THREADS
+    int slot = threadSlot();
+    if (allocator != NULL && slot >= 0) {
+        cacheDrain(allocator, slot);
+    }
+#else
+    (void)allocator;
+#endif
+}
+
+// First fit: the lowest addressed hole that can hold size.
+MemoryNode* findFirstfit(allocator_t* allocator, size_t size) {
+    MemoryNode *first = treeFindFrom(allocator->addressTree, NULL, size);
+    if (first == NULL) {
+        return NULL;
+    }
+
+    return takeNode(allocator, first, size);
+}
+
+// Best fit: the smallest hole that can hold size, lowest address on ties.
+// That is the first node in tree order whose size is at least size.
+MemoryNode* findBestFit(allocator_t* allocator, size_t size) {
+    MemoryNode *best = NULL;
+
+    MemoryNode *current = allocator->bestFitTree;
+    while (current != NULL) {
+        if (current->size >= size) {
+            best = current;
+            current = current->left;
+        } else {
+            current = current->right;
+        }
+    }
+
+    if (best == NULL) {
+        return NULL;
+    }
+
+    return takeNode(allocator, best, size);
+}
+
+// Worst fit: the largest hole, lowest address on ties.
+MemoryNode* findWorstFit(allocator_t* allocator, size_t size) {
+    if (allocator->worstFitHeapSize == 0 || allocator->worstFitHeap[0]->size < size) {
+        return NULL;
+    }
+
+    return takeNode(allocator, allocator->worstFitHeap[0], size);
+}
+
+// Next fit: the lowest addressed hole at or after the end of the last
+// allocation that can hold size, wrapping around to the lowest addressed one.
+MemoryNode* findNextFit(allocator_t* allocator, size_t size) {
+    MemoryNode *next = treeFindFrom(allocator->addressTree, allocator->nextFitRover, size);
+    if (next == NULL) {
+        next = treeFindFrom(allocator->addressTree, NULL, size);
+    }
+
+    if (next == NULL) {
+        return NULL;
+    }
+
+    next = takeNode(allocator, next, size);
+    allocator->nextFitRover = next->start + next->size;
+    return next;
+}
+
+// TLSF: the head of the first non-empty list whose smallest size is at least
+// size. That is not always the best fit, but it takes constant time.
+MemoryNode* findTlsf(allocator_t* allocator, size_t size) {
+    // Round up to the start of the next list, so any hole in it is big enough
+    size_t rounded = size + ((size_t)1 << (63 - __builtin_clzl(size) - TLSF_SL_SHIFT)) - 1;
+    if (rounded < size) {
+        return NULL;
+    }
+
+    int fl, sl;
+    tlsfMapping(rounded, &fl, &sl);
+
+    // A larger list of the same class, or else the first list of a larger class
+    unsigned int slMap = allocator->tlsfSlMap[fl] & (~0u << sl);
+    if (slMap == 0) {
+        unsigned long flMap = allocator->tlsfFlMap & ~((2ul << fl) - 1);
+        if (flMap == 0) {
+            // Nothing is sure to fit, but the first hole of size's own list
+            // still might, such as the one left once everything is freed
+            tlsfMapping(size, &fl, &sl);
+            MemoryNode *head = allocator->tlsfLists[fl][sl];
+            if (head == NULL || head->size < size) {
+                return NULL;
+            }
+            return takeNode(allocator, head, size);
+        }
+        fl = __builtin_ctzl(flMap);
+        slMap = allocator->tlsfSlMap[fl];
+    }
+    sl = __builtin_ctz(slMap);
+
+    return takeNode(allocator, allocator->tlsfLists[fl][sl], size);
+}
+
+// Removes a free node from its index, splits off whatever it does not need for
+// size and marks it used.
+MemoryNode* takeNode(allocator_t* allocator, MemoryNode* node, size_t size) {
+    freeDelete(allocator, node);
+
+    // The leftover only becomes its own hole if there is room for its tags,
+    // otherwise the whole block is handed out and its right neighbour learns
+    // that it now follows a used block.
+    if (node->size - size >= MIN_BLOCK_SIZE) {
+        split(allocator, node, size);
+    } else {
+        setPrevUsed(allocator, node->start + node->size, 1);
+
+        // The footer now lies inside the block
+        if (node->dirty < node->size) {
+            *(size_t*)(node->start + node->size - HEADER_SIZE) = 0;
+        }
+    }
+
+    size_t *header = node->start;
+    *header = node->size | TAG_USED | (*header & TAG_PREV_USED);
+    node->used = 1;
+    return node;
+}
+
+// Carves the memory into the largest power of two blocks that fit. Each one
+// is the root of its own buddy tree and sits on a multiple of its own size
+// from memStart, which is what makes the XOR buddy lookup work.
+void buddySetup(allocator_t* allocator) {
+    allocator->buddyTable = calloc((allocator->memSize >> MIN_BUDDY_ORDER) + 1, sizeof(MemoryNode*));
+
+    size_t offset = 0;
+    for (int order = NUM_BINS - 1; order >= MIN_BUDDY_ORDER; order--) {
+        if (allocator->memSize - offset >= 1ul << order) {
+            MemoryNode *newNode = createNewNode(allocator, allocator->memStart + offset, 1ul << order);
+            listTailInsert(&allocator->memoryNodes, newNode);
+            freeInsert(allocator, newNode);
+            allocator->buddyTable[offset >> MIN_BUDDY_ORDER] = newNode;
+
+            offset += 1ul << order;
+        }
+    }
+}
+
+// Finds the smallest free block of at least size bytes, rounded up to a power
+// of two, splitting larger blocks in half until one of the right order exists.
+MemoryNode* buddyAlloc(allocator_t* allocator, size_t size) {
+    int order = 64 - __builtin_clzl(size - 1);
+    if (order < MIN_BUDDY_ORDER) {
+        order = MIN_BUDDY_ORDER;
+    }
+    if (order >= NUM_BINS) {
+        return NULL;
+    }
+
+    unsigned long orders = allocator->freeBinMap & ~((1ul << order) - 1);
+    if (orders == 0) {
+        return NULL;
+    }
+
+    int currentOrder = __builtin_ctzl(orders);
+    MemoryNode *node = allocator->freeBins[currentOrder].head;
+    freeDelete(allocator, node);
+
+    // Keep the lower half and put the upper half on the free list of its order
+    while (currentOrder > order) {
+        currentOrder--;
+        node->size = 1ul << currentOrder;
+
+        MemoryNode *newSplit = createNewNode(allocator, node->start + node->size, node->size);
+        newSplit->dirty = (node->dirty > node->size) ? node->dirty - node->size : 0;
+        if (node->dirty > node->size) {
+            node->dirty = node->size;
+        }
+        listInsertAfter(&allocator->memoryNodes, node, newSplit);
+        freeInsert(allocator, newSplit);
+        allocator->buddyTable[(newSplit->start - allocator->memStart) >> MIN_BUDDY_ORDER] = newSplit;
+    }
+
+    *(size_t*)(node->start + BUDDY_HEADER_SIZE - HEADER_SIZE) = node->size;
+    node->used = 1;
+    return node;
+}
+
+// Buddy blocks are only aligned to their own size from memStart, and the
+// pointer into them has to leave room for the header. So an aligned request
+// takes a block that is alignment bytes larger and hands out the first aligned
+// address in it. Returns -1 if there is no such block.
+void *buddyAllocAligned(allocator_t* allocator, size_t size, size_t alignment) {
+    void *start;
+    if (allocator->mallocType == BUDDY_TREE) {
+        start = buddyTreeAlloc(allocator, size + BUDDY_HEADER_SIZE + alignment, size);
+    } else {
+        MemoryNode *node = buddyAlloc(allocator, size + BUDDY_HEADER_SIZE + alignment);
+        start = (node != NULL) ? node->start : NULL;
+        if (node != NULL) {
+            usageTake(allocator, node, size);
+        }
+    }
+    if (start == NULL) {
+        return (void*)-1;
+    }
+
+    // The block's own header is right in front of its usual pointer, so that
+    // one needs no tag, and a tag there would overwrite the header
+    void *ptr = (void*)(((size_t)start + BUDDY_HEADER_SIZE + alignment - 1) & ~(alignment - 1));
+    if (ptr != start + BUDDY_HEADER_SIZE) {
+        *(size_t*)(ptr - HEADER_SIZE) = (ptr - start) | TAG_ALIGNED;
+    }
+    return ptr;
+}
+
+// Resizes the used block node in place to the smallest power of two that
+// holds size. It shrinks by giving its upper halves back, and grows by taking
+// in its buddies for as long as they are free and lie above it. Returns 0,
+// leaving node as it was, if it can't grow far enough.
+int buddyResize(allocator_t* allocator, MemoryNode* node, size_t size) {
+    int order = 64 - __builtin_clzl(size - 1);
+    if (order < MIN_BUDDY_ORDER) {
+        order = MIN_BUDDY_ORDER;
+    }
+
+    // Check the whole way up before taking anything in
+    size_t offset = node->start - allocator->memStart;
+    for (size_t blockSize = node->size; blockSize < 1ul << order; blockSize *= 2) {
+        if ((offset & blockSize) != 0 || offset + blockSize * 2 > allocator->memSize) {
+            return 0;
+        }
+
+        MemoryNode *buddy = allocator->buddyTable[(offset + blockSize) >> MIN_BUDDY_ORDER];
+        if (buddy == NULL || buddy->used == 1 || buddy->size != blockSize) {
+            return 0;
+        }
+    }
+
+    while (node->size < 1ul << order) {
+        MemoryNode *buddy = allocator->buddyTable[(offset + node->size) >> MIN_BUDDY_ORDER];
+        freeDelete(allocator, buddy);
+        allocator->buddyTable[(offset + node->size) >> MIN_BUDDY_ORDER] = NULL;
+        listDelete(&allocator->memoryNodes, buddy);
+        releaseNode(allocator, buddy);
+        node->size *= 2;
+    }
+
+    // The upper half's buddy is node itself, which is used, so it can't merge
+    while (node->size > 1ul << order) {
+        node->size /= 2;
+
+        MemoryNode *upper = createNewNode(allocator, node->start + node->size, node->size);
+        upper->dirty = upper->size;
+        listInsertAfter(&allocator->memoryNodes, node, upper);
+        freeInsert(allocator, upper);
+        allocator->buddyTable[(offset + node->size) >> MIN_BUDDY_ORDER] = upper;
+    }
+
+    *(size_t*)(node->start + BUDDY_HEADER_SIZE - HEADER_SIZE) = node->size;
+    return 1;
+}
+
+// Frees node and merges it with its buddy for as long as the buddy is a free
+// block of the same order.
+void buddyFree(allocator_t* allocator, MemoryNode* node) {
+    node->used = 0;
+    node->dirty = node->size;
+
+    while (1) {
+        size_t size = node->size;
+        size_t buddyOffset = (node->start - allocator->memStart) ^ size;
+
+        // The buddy of a root block lies outside the memory or is smaller than it
+        if (buddyOffset + size > allocator->memSize) {
+            break;
+        }
+
+        MemoryNode *buddy = allocator->buddyTable[buddyOffset >> MIN_BUDDY_ORDER];
+        if (buddy == NULL || buddy->used == 1 || buddy->size != size) {
+            break;
+        }
+
+        freeDelete(allocator, buddy);
+
+        // The merged block starts at the lower of the two
+        if (buddy->start < node->start) {
+            MemoryNode *temp = buddy;
+            buddy = node;
+            node = temp;
+        }
 
-// Function prototypes
-void listTailInsert(MemoryList*, MemoryNode*);
-void listHeadInsert(MemoryList*, MemoryNode*);
-void listDelete(MemoryList*, MemoryNode*);
-void printList(MemoryList*, int);
-MemoryNode* createNewNode(void*, int);
-MemoryNode* split(MemoryList*, MemoryNode*, int);
-void merge(MemoryList*, MemoryNode*);
-MemoryNode* findFirstfit(MemoryList*, int);
-MemoryNode* findBestFit(MemoryList*, int);
-MemoryNode* findWorstFit(MemoryList*, int);
+        allocator->buddyTable[(buddy->start - allocator->memStart) >> MIN_BUDDY_ORDER] = NULL;
+        listDelete(&allocator->memoryNodes, buddy);
+        releaseNode(allocator, buddy);
+        node->dirty = size + buddy->dirty;
+        node->size = size * 2;
+    }
 
-// Globals
-MemoryList *memoryNodes;
+    freeInsert(allocator, node);
+}
 
-int MALLOC_TYPE = 0;
-int MEM_SIZE = 0;
-void* MEM_START;
+// Fills in the buddy tree from the smallest blocks up. Those that lie inside
+// the memory are free and those past its end can never be handed out, so the
+// blocks straddling the end are never free as a whole.
+void buddyTreeSetup(allocator_t* allocator) {
+    int order = buddyTreeOrderFor(allocator->memSize);
+    allocator->buddyTreeOrder = order;
+
+    size_t leaves = 1ul << (order - MIN_BUDDY_ORDER);
+    allocator->buddyTree = malloc(leaves * 2);
+    for (size_t i = 0; i < leaves; i++) {
+        size_t end = (i + 1) << MIN_BUDDY_ORDER;
+        allocator->buddyTree[leaves + i] = (end <= allocator->memSize) ? MIN_BUDDY_ORDER + 1 : 0;
+    }
+    for (size_t i = leaves - 1; i >= 1; i--) {
+        buddyTreeUpdate(allocator, i);
+    }
 
-void setup(int malloc_type, int mem_size, void* start_of_memory) {
+    // The free blocks are the buddy blocks that make up the memory's smallest
+    // blocks, one for every bit set in their count
+    size_t inside = allocator->memSize >> MIN_BUDDY_ORDER;
+    allocator->usage->freeBytes = inside << MIN_BUDDY_ORDER;
+    allocator->usage->freeFragments = __builtin_popcountl(inside);
+}
 
-    if (mem_size > MAX_MEM_SIZE) {
-        printf("Maximum requested memory.");
-        return;
+// Order of the root of a buddy tree over mem_size bytes
+int buddyTreeOrderFor(size_t mem_size) {
+    int order = MIN_BUDDY_ORDER;
+    while (order < NUM_BINS - 1 && 1ul << order < mem_size) {
+        order++;
     }
+    return order;
+}
 
-    MALLOC_TYPE = malloc_type;
-    MEM_SIZE = mem_size;
-    MEM_START = start_of_memory;
+// Recomputes entry i of the buddy tree from its two halves. The block is free
+// as a whole exactly when both of its halves are.
+void buddyTreeUpdate(allocator_t* allocator, size_t i) {
+    unsigned char *tree = allocator->buddyTree;
+    int free = buddyTreeOrderOf(allocator, i);
+    if (tree[2 * i] == free && tree[2 * i + 1] == free) {
+        tree[i] = free + 1;
+    } else {
+        tree[i] = (tree[2 * i] > tree[2 * i + 1]) ? tree[2 * i] : tree[2 * i + 1];
+    }
+}
 
-    // All allocation policies will allocate one node of size mem_size at address MEM_START
-    memoryNodes = malloc(sizeof(MemoryList));
-    MemoryNode *newNode = createNewNode(MEM_START, MEM_SIZE);
-    listTailInsert(memoryNodes, newNode);
+// Order of the block at entry i: one less for every level below the root
+int buddyTreeOrderOf(allocator_t* allocator, size_t i) {
+    return allocator->buddyTreeOrder - (63 - __builtin_clzl(i));
 }
 
-void *my_malloc(int size) {
+// Takes a free block of the smallest order that holds size bytes for a caller
+// who asked for requested bytes and returns its start, or NULL. It goes down
+// from the root into a half that has room, the one with the smaller largest
+// free block if both do, so large blocks are split as late as possible, then
+// marks the path back up.
+void *buddyTreeAlloc(allocator_t* allocator, size_t size, size_t requested) {
+    int order = 64 - __builtin_clzl(size - 1);
+    if (order < MIN_BUDDY_ORDER) {
+        order = MIN_BUDDY_ORDER;
+    }
 
-    if (size < MIN_MALLOC_SIZE) {
-        return (void*) -1;
+    unsigned char *tree = allocator->buddyTree;
+    sharedLock(allocator);
+    if (order > allocator->buddyTreeOrder || tree[1] <= order) {
+        sharedUnlock(allocator);
+        return NULL;
     }
 
-    int fullSize = size + 4;
-    switch (MALLOC_TYPE) {
-        case FIRST_FIT: {
-            MemoryNode* freeNode = findFirstfit(memoryNodes, fullSize);
-            if (freeNode != NULL) {
-                return freeNode->start + 4;
-            } else {
-                return (void*)-1;
-            }
-            break;
+    // Order of the free block the one handed out is split from
+    int taken = -1;
+
+    size_t i = 1;
+    int current = allocator->buddyTreeOrder;
+    while (current > order) {
+        if (taken < 0 && tree[i] == current + 1) {
+            taken = current;
         }
 
-        case BEST_FIT: {
-            MemoryNode* freeNode = findBestFit(memoryNodes, fullSize);
-            if (freeNode != NULL) {
-                return freeNode->start + 4;
-            } else {
-                return (void*)-1;
+        unsigned char left = tree[2 * i];
+        unsigned char right = tree[2 * i + 1];
+
+        // Only a process of a shared heap dying halfway through an update can
+        // leave an entry promising more than its halves have. Fix the way up
+        // and start over.
+        if (left <= order && right <= order) {
+            for (; i >= 1; i /= 2) {
+                buddyTreeUpdate(allocator, i);
             }
+            if (tree[1] <= order) {
+                sharedUnlock(allocator);
+                return NULL;
+            }
+            i = 1;
+            current = allocator->buddyTreeOrder;
+            taken = -1;
+            continue;
+        }
 
-            break;
+        i *= 2;
+        if (left <= order || (right > order && right < left)) {
+            i++;
         }
+        current--;
+    }
 
-        case WORST_FIT: {
-            MemoryNode* freeNode = findWorstFit(memoryNodes, fullSize);
-            if (freeNode != NULL) {
-                return freeNode->start + 4;
-            } else {
-                return (void*)-1;
-            }
+    tree[i] = 0;
+    size_t offset = (i - (1ul << (allocator->buddyTreeOrder - order))) << order;
+    for (size_t parent = i / 2; parent >= 1; parent /= 2) {
+        buddyTreeUpdate(allocator, parent);
+    }
+
+    // Splitting leaves one free block behind on every order on the way down
+    if (taken < 0) {
+        taken = order;
+    }
+    allocator->usage->freeBytes -= 1ul << order;
+    allocator->usage->freeFragments += taken - order;
+    allocator->usage->freeFragments--;
+    allocator->usage->usedBytes += 1ul << order;
+    COUNT(allocator->usage->requestedBytes, requested);
+    sharedUnlock(allocator);
+
+    // Nothing else uses the start of the header, so it keeps what was asked for
+    void *start = allocator->memStart + offset;
+    *(size_t*)start = requested;
+    *(size_t*)(start + BUDDY_HEADER_SIZE - HEADER_SIZE) = 1ul << order;
+    return start;
+}
+
+// The entry of the used block starting at offset, or 0 if there is none.
+// Entries below a used block still say they are free, and the entries above
+// it have free space somewhere else unless they are 0 too. So it is the first
+// 0 on the way up from the smallest block at offset, as long as the way stays
+// on blocks that start at offset.
+size_t buddyTreeFind(allocator_t* allocator, size_t offset) {
+    if (offset + (1 << MIN_BUDDY_ORDER) > allocator->memSize) {
+        return 0;
+    }
+
+    size_t i = (1ul << (allocator->buddyTreeOrder - MIN_BUDDY_ORDER)) + (offset >> MIN_BUDDY_ORDER);
+    sharedLock(allocator);
+    while (allocator->buddyTree[i] != 0) {
+        // The block above an upper half starts before offset
+        if (i % 2 == 1) {
+            i = 0;
             break;
         }
+        i /= 2;
+    }
+    sharedUnlock(allocator);
 
-        case BUDDY_SYSTEM: {
-            // Default to an error
-            void *rtrVal = (void*) -1;
-
-            // Find smallest base 2 size that can fulfill the request
-            // Once we find the smallest size, try to find a free node
-            // with that exact size.
-            int buddySize = 0;
-            int power = 0;
-            while (fullSize > buddySize) {
-                buddySize = 1 << power;
-                power++;
-            }
-
-            // Find free node that can fit buddy size exactly
-            MemoryNode *freeNode = memoryNodes->head;
-            while (freeNode != NULL) {
-                if (*freeNode->size == buddySize && freeNode->used == 0) {
-                    break;
-                }
-                freeNode = freeNode->next;
-            }
+    return i;
+}
 
-            // If a free node of exact size was found, complete the request
-            // Else we need to find the smallest possible node that can fulfill the request
-            if (freeNode != NULL) {
-                freeNode->used = 1;
-                rtrVal = freeNode->start + 4;
+// Frees the used block at entry i. Its buddy being free makes the block above
+// them free as a whole, which is all merging takes.
+void buddyTreeFree(allocator_t* allocator, size_t i) {
+    int order = buddyTreeOrderOf(allocator, i);
+    void *start = allocator->memStart + ((i - (1ul << (allocator->buddyTreeOrder - order))) << order);
+
+    sharedLock(allocator);
+    allocator->usage->usedBytes -= 1ul << order;
+    COUNT(allocator->usage->requestedBytes, -*(size_t*)start);
+    allocator->usage->freeBytes += 1ul << order;
+    allocator->usage->freeFragments++;
+
+    // Each block above that becomes free as a whole is two free blocks merged
+    int merging = 1;
+    allocator->buddyTree[i] = order + 1;
+    for (i /= 2; i >= 1; i /= 2) {
+        buddyTreeUpdate(allocator, i);
+        if (merging && allocator->buddyTree[i] == buddyTreeOrderOf(allocator, i) + 1) {
+            allocator->usage->freeFragments--;
+        } else {
+            merging = 0;
+        }
+    }
+    sharedUnlock(allocator);
+}
 
-                return rtrVal;
-            } else {
-                // Need to find a free node to split
-                MemoryNode *currentNode = memoryNodes->head;
-                MemoryNode *smallestNode = NULL;
-                int smallestSize = *memoryNodes->head->size;
-
-                // Set initial smallest start pointer to the head's start pointer if list only contains 1 node,
-                //      set initial value to 2nd node otherwise.
-                // If smallest start pointer is initially set to the head everytime, then when node 1 has
-                // the same size as node 2, but node 1 is used, node 2's start pointer is not <= 0 (start pointer of node 1)
-                // so smallestStartPtr is never set to node 2's start pointer
-                void* smallestStartPtr = (memoryNodes->size == 1) ? memoryNodes->head->start : memoryNodes->head->next->start;
-
-                // Find the smallest free node with the smallest start pointer
-                while (currentNode != NULL) {
-                    if (currentNode->used == 0 && *currentNode->size <= smallestSize && currentNode->start <= smallestStartPtr) {
-                        smallestNode = currentNode;
-                        smallestSize = *currentNode->size;
-                        smallestStartPtr = currentNode->start;
-                    }
-                    currentNode = currentNode->next;
-                }
+// Prints every free and used block below entry i in address order. A 0 entry
+// is a used block if its halves still say they are free, and is split otherwise.
+void buddyTreePrint(allocator_t* allocator, size_t i) {
+    int order = buddyTreeOrderOf(allocator, i);
+    size_t offset = (i - (1ul << (allocator->buddyTreeOrder - order))) << order;
+    if (offset + (1ul << MIN_BUDDY_ORDER) > allocator->memSize) {
+        return;
+    }
 
-                if (smallestNode != NULL) {
-                    // Keep splitting smallest node until a node of size buddySize is created.
-                    int currentSplitSize = *smallestNode->size;
-                    while (currentSplitSize != buddySize) {
-                        currentSplitSize -= currentSplitSize / 2;
-                        *smallestNode->size = currentSplitSize;
-                        MemoryNode *newSplit = createNewNode(smallestNode->start + currentSplitSize, currentSplitSize);
-
-                        // Splitting the tail has to be handled differently
-                        if (smallestNode == memoryNodes->tail) {
-                            newSplit->next = NULL;
-                            newSplit->prev = smallestNode;
-                            smallestNode->next = newSplit;
-                            memoryNodes->tail = newSplit;
-                        } else {
-                            newSplit->next = smallestNode->next;
-                            newSplit->prev = smallestNode;
-                            smallestNode->next = newSplit;
-                        }
-
-                        memoryNodes->size++;
-
-                        if (*smallestNode->size == buddySize) {
-                            smallestNode->used = 1;
-                            rtrVal = smallestNode->start + 4;
-                            break;
-                        }
-                    }
-
-                    return rtrVal;
-
-                } else {
-                    // Check if tail can be split
-                    if (memoryNodes->tail->used == 0 && *memoryNodes->tail->size >= buddySize) {
-                        int currentSplitSize = *memoryNodes->tail->size;
-
-                        while (currentSplitSize != buddySize) {
-                            currentSplitSize -= currentSplitSize / 2;
-
-                            *memoryNodes->tail->size = currentSplitSize;
-                            if (*memoryNodes->tail->size == buddySize) {
-                                memoryNodes->tail->used = 1;
-                            }
-                            MemoryNode *newSplit = createNewNode(memoryNodes->tail->start + currentSplitSize, currentSplitSize);
-                            listTailInsert(memoryNodes, newSplit);
-
-                            rtrVal = newSplit->prev->start + 4;
-                        }
-                    } else {
-                        rtrVal = (void*) -1;
-                    }
-
-                    return rtrVal;
-                }
-            }
-            break;
+    unsigned char *tree = allocator->buddyTree;
+    int used = tree[i] == 0 && (order == MIN_BUDDY_ORDER || tree[2 * i] != 0);
+    if (used || tree[i] == order + 1) {
+        printf("\t\t[start=%p size=%zu, used=%d]\n", allocator->memStart + offset, 1ul << order, used);
+    } else if (order > MIN_BUDDY_ORDER) {
+        buddyTreePrint(allocator, 2 * i);
+        buddyTreePrint(allocator, 2 * i + 1);
+    }
+}
+
+// Creates and initializes a new memory node
+MemoryNode* createNewNode(allocator_t* allocator, void* start, size_t size) {
+    // Take a new chunk when the free list runs dry and put all its nodes on it
+    if (allocator->freeNodes == NULL) {
+        NodeChunk *chunk = malloc(sizeof(NodeChunk));
+        chunk->next = allocator->nodeChunks;
+        allocator->nodeChunks = chunk;
+
+        for (int i = 0; i < NODE_CHUNK_SIZE; i++) {
+            releaseNode(allocator, &chunk->nodes[i]);
         }
     }
+
+    MemoryNode *newNode = allocator->freeNodes;
+    allocator->freeNodes = newNode->next;
+    newNode->start = start;
+    newNode->size = size;
+    newNode->dirty = size;
+    newNode->used = 0;
+    newNode->binPrev = NULL;
+    newNode->binNext = NULL;
+
+    return newNode;
 }
 
-void my_free(void *ptr) {
-    // Check for invalid pointers
-    // Any frees should always be within our given memory space: [MEM_START..MEM_START+MAX_MEM_SIZE]
-    if (ptr == NULL || ptr < MEM_START || ptr > MEM_START + MAX_MEM_SIZE) {
-        printf("[Trying to free an invalid pointer]\n");
+// Gives a node that is no longer part of any list, bin or table back to the pool
+void releaseNode(allocator_t* allocator, MemoryNode* node) {
+    node->next = allocator->freeNodes;
+    allocator->freeNodes = node;
+}
+
+// Splits a node into a given size.
+// node's size = size, and a new free node is created right after it that is
+// the size of node's original size - size
+MemoryNode* split(allocator_t* allocator, MemoryNode* node, size_t size) {
+    MemoryNode *newNode = createNewNode(allocator, node->start + size, node->size - size);
+    newNode->dirty = (node->dirty > size + HEADER_SIZE) ? node->dirty - size : HEADER_SIZE;
+    setFreeTags(newNode->start, newNode->size);
+    nodeTableInsert(allocator, newNode);
+    freeInsert(allocator, newNode);
+
+    node->size = size;
+    node->used = 0;
+
+    return node;
+}
+
+// Frees node and merges it with the free blocks physically adjacent to it.
+// The neighbours are found through the boundary tags, so this does not depend
+// on the order nodes were created in.
+void merge(allocator_t* allocator, MemoryNode* node) {
+    size_t prevUsed = *(size_t*)node->start & TAG_PREV_USED;
+    node->used = 0;
+    node->dirty = node->size;
+
+    // Absorb the right neighbour first so node still exists to be absorbed into the left.
+    // Whatever it has that is zero stays zero.
+    void *nextStart = node->start + node->size;
+#ifdef MEMALLOC_THREADS
+    // A used neighbour may be getting freed by another thread, which marks its header
+    size_t nextTag = blockAt(allocator, nextStart) ? __atomic_load_n((size_t*)nextStart, __ATOMIC_RELAXED) : TAG_USED;
+#else
+    size_t nextTag = blockAt(allocator, nextStart) ? *(size_t*)nextStart : TAG_USED;
+#endif
+    if ((nextTag & TAG_USED) == 0) {
+        MemoryNode *next = nodeTableFind(allocator, nextStart);
+        freeDelete(allocator, next);
+        node->dirty = node->size + next->dirty;
+        node->size = node->size + next->size;
+        nodeTableDelete(allocator, next);
+        releaseNode(allocator, next);
+    }
+
+    // The left neighbour's footer is only there if it is free
+    if (!prevUsed) {
+        size_t prevSize = *(size_t*)(node->start - HEADER_SIZE);
+        MemoryNode *prev = nodeTableFind(allocator, node->start - prevSize);
+        freeDelete(allocator, prev);
+        prev->dirty = prev->size + node->dirty;
+        prev->size = prev->size + node->size;
+        nodeTableDelete(allocator, node);
+        releaseNode(allocator, node);
+        node = prev;
+    }
+
+    setFreeTags(node->start, node->size);
+    setPrevUsed(allocator, node->start + node->size, 0);
+    freeInsert(allocator, node);
+}
+
+// Writes the header and footer of a free block. Two free blocks are never
+// adjacent, so the block to its left is always used.
+void setFreeTags(void* start, size_t size) {
+    *(size_t*)start = size | TAG_PREV_USED;
+    *(size_t*)(start + size - HEADER_SIZE) = size;
+}
+
+// Updates the flag in a block's header that says whether its left neighbour is used
+void setPrevUsed(allocator_t* allocator, void* start, int prevUsed) {
+    if (!blockAt(allocator, start)) {
         return;
     }
 
-    void* start = (ptr - 4);
-    int size = *((int*)(ptr-4));
+    size_t *header = start;
+#ifdef MEMALLOC_THREADS
+    // start may be a used block sitting in another thread's cache, which
+    // reads its header without the lock
+    if (prevUsed) {
+        __atomic_fetch_or(header, TAG_PREV_USED, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(header, ~TAG_PREV_USED, __ATOMIC_RELAXED);
+    }
+#else
+    if (prevUsed) {
+        *header |= TAG_PREV_USED;
+    } else {
+        *header &= ~TAG_PREV_USED;
+    }
+#endif
+}
+
+// Fibonacci hash of the block's offset from memStart. The top bits of the
+// product are used, the low ones only depend on the low bits of the offset,
+// which are always zero.
+size_t nodeTableSlot(allocator_t* allocator, void* start) {
+    size_t offset = start - allocator->memStart;
+    return (offset * 11400714819323198485ul) >> (64 - __builtin_ctzl(allocator->nodeTableSize));
+}
 
-    switch (MALLOC_TYPE) {
-        case FIRST_FIT:
-        case BEST_FIT:
-        case WORST_FIT: {
-            // If there is only 1 hole in the list and is being used, free it.
-            if (memoryNodes->size <= 1) {
-                if (memoryNodes->head->used == 1) {
-                    memoryNodes->head->used = 0;
-                }
-            } else {
-                // Merge any adjacent free nodes.
-                MemoryNode *current = memoryNodes->head;
-                while (current != NULL) {
-                    if (current->start == start && current->used == 1) {
-                        merge(memoryNodes, current);
-
-                        return;
-                    }
-                    current = current->next;
-                }
+void nodeTableInsert(allocator_t* allocator, MemoryNode *node) {
+    // Double the table once it is half full and re-insert every node
+    if ((allocator->nodeTableCount + 1) * 2 > allocator->nodeTableSize) {
+        MemoryNode **oldTable = allocator->nodeTable;
+        size_t oldSize = allocator->nodeTableSize;
+
+        allocator->nodeTableSize *= 2;
+        allocator->nodeTableCount = 0;
+        allocator->nodeTable = calloc(allocator->nodeTableSize, sizeof(MemoryNode*));
+        for (size_t i = 0; i < oldSize; i++) {
+            if (oldTable[i] != NULL) {
+                nodeTableInsert(allocator, oldTable[i]);
             }
-            break;
         }
+        free(oldTable);
+    }
 
-        case BUDDY_SYSTEM: {
+    size_t slot = nodeTableSlot(allocator, node->start);
+    while (allocator->nodeTable[slot] != NULL) {
+        slot = (slot + 1) & (allocator->nodeTableSize - 1);
+    }
+    allocator->nodeTable[slot] = node;
+    allocator->nodeTableCount++;
+}
 
-            // Find the memory location in the list that needs to be freed
-            MemoryNode *currentNode = memoryNodes->head;
-            MemoryNode *nodeToFree = NULL;
-            while (currentNode != NULL) {
-                if (currentNode->start == start && currentNode->used == 1) {
-                    nodeToFree = currentNode;
-                    break;
-                }
-                currentNode = currentNode->next;
-            }
-
-            if (nodeToFree != NULL) {
-                nodeToFree->used = 0;
-                // Iterate through the list to find nodes that can be merged
-                // Look at the right node, if it has the same size and is unused
-                // then it can be merged into the current node. Everytime we merge,
-                // go back to the beginning of the list and check again
-                currentNode = memoryNodes->head;
-                while (currentNode != NULL) {
-                    if (currentNode->next != NULL && *currentNode->next->size == *currentNode->size && currentNode->next->used == 0 && currentNode->used == 0) {
-                        *currentNode->size += *currentNode->next->size;
-                        currentNode->next = currentNode->next->next;
-
-                        currentNode = memoryNodes->head;
-                        memoryNodes->size--;
-                     } else {
-                         currentNode = currentNode->next;
-                     }
-                }
-            }
+MemoryNode* nodeTableFind(allocator_t* allocator, void* start) {
+    size_t slot = nodeTableSlot(allocator, start);
+    while (allocator->nodeTable[slot] != NULL) {
+        if (allocator->nodeTable[slot]->start == start) {
+            return allocator->nodeTable[slot];
+        }
+        slot = (slot + 1) & (allocator->nodeTableSize - 1);
+    }
+
+    return NULL;
+}
+
+// Removes node and shifts back any later entries of its probe run that would
+// otherwise become unreachable, so lookups never need tombstones.
+void nodeTableDelete(allocator_t* allocator, MemoryNode *node) {
+    size_t slot = nodeTableSlot(allocator, node->start);
+    while (allocator->nodeTable[slot] != node) {
+        slot = (slot + 1) & (allocator->nodeTableSize - 1);
+    }
 
+    size_t hole = slot;
+    while (1) {
+        slot = (slot + 1) & (allocator->nodeTableSize - 1);
+        if (allocator->nodeTable[slot] == NULL) {
             break;
         }
+
+        // An entry can move into the hole unless its home slot lies
+        // cyclically after the hole and at or before where it sits now
+        size_t home = nodeTableSlot(allocator, allocator->nodeTable[slot]->start);
+        if (((slot - home) & (allocator->nodeTableSize - 1)) >= ((slot - hole) & (allocator->nodeTableSize - 1))) {
+            allocator->nodeTable[hole] = allocator->nodeTable[slot];
+            hole = slot;
+        }
     }
 
+    allocator->nodeTable[hole] = NULL;
+    allocator->nodeTableCount--;
 }
 
-MemoryNode* findFirstfit(MemoryList* list, int size) {
-    MemoryNode *current = memoryNodes->head;
-    while (current != NULL) {
-        int currentSize = *(current->size);
-        if (currentSize + 4 >= size && current->used == 0) {
-            if (currentSize + 4 > size) {
-                split(memoryNodes, current, size);
-            }
+// Adds a free node to the index its policy searches
+void freeInsert(allocator_t* allocator, MemoryNode *node) {
+    allocator->usage->freeBytes += node->size;
+    allocator->usage->freeFragments++;
+
+    if (allocator->mallocType == BEST_FIT || allocator->mallocType == FIRST_FIT || allocator->mallocType == NEXT_FIT) {
+        node->left = NULL;
+        node->right = NULL;
+        node->height = 1;
+        node->maxSize = node->size;
+        if (allocator->mallocType == BEST_FIT) {
+            allocator->bestFitTree = treeInsert(allocator->bestFitTree, node, 0);
+        } else {
+            allocator->addressTree = treeInsert(allocator->addressTree, node, 1);
+        }
+    } else if (allocator->mallocType == WORST_FIT) {
+        heapInsert(allocator, node);
+    } else if (allocator->mallocType == TLSF) {
+        tlsfInsert(allocator, node);
+    } else {
+        binPush(allocator, node);
+    }
+}
+
+void freeDelete(allocator_t* allocator, MemoryNode *node) {
+    allocator->usage->freeBytes -= node->size;
+    allocator->usage->freeFragments--;
+
+    if (allocator->mallocType == BEST_FIT) {
+        allocator->bestFitTree = treeDelete(allocator->bestFitTree, node, 0);
+    } else if (allocator->mallocType == FIRST_FIT || allocator->mallocType == NEXT_FIT) {
+        allocator->addressTree = treeDelete(allocator->addressTree, node, 1);
+    } else if (allocator->mallocType == WORST_FIT) {
+        heapDelete(allocator, node);
+    } else if (allocator->mallocType == TLSF) {
+        tlsfDelete(allocator, node);
+    } else {
+        binDelete(allocator, node);
+    }
+}
+
+// Whether a belongs above b in the worst fit heap: larger first, then lower address
+int heapAbove(MemoryNode *a, MemoryNode *b) {
+    return a->size > b->size || (a->size == b->size && a->start < b->start);
+}
+
+void heapPlace(allocator_t* allocator, MemoryNode *node, int index) {
+    allocator->worstFitHeap[index] = node;
+    node->heapIndex = index;
+}
+
+void heapSiftUp(allocator_t* allocator, MemoryNode *node) {
+    int index = node->heapIndex;
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!heapAbove(node, allocator->worstFitHeap[parent])) {
+            break;
+        }
+        heapPlace(allocator, allocator->worstFitHeap[parent], index);
+        index = parent;
+    }
+    heapPlace(allocator, node, index);
+}
 
-            current->used = 1;
-            return current;
+void heapSiftDown(allocator_t* allocator, MemoryNode *node) {
+    int index = node->heapIndex;
+    while (1) {
+        int child = index * 2 + 1;
+        if (child >= allocator->worstFitHeapSize) {
+            break;
+        }
+        if (child + 1 < allocator->worstFitHeapSize && heapAbove(allocator->worstFitHeap[child + 1], allocator->worstFitHeap[child])) {
+            child++;
+        }
+        if (!heapAbove(allocator->worstFitHeap[child], node)) {
+            break;
         }
+        heapPlace(allocator, allocator->worstFitHeap[child], index);
+        index = child;
+    }
+    heapPlace(allocator, node, index);
+}
 
-        current = current->next;
+void heapInsert(allocator_t* allocator, MemoryNode *node) {
+    if (allocator->worstFitHeapSize == allocator->worstFitHeapCapacity) {
+        allocator->worstFitHeapCapacity *= 2;
+        allocator->worstFitHeap = realloc(allocator->worstFitHeap, allocator->worstFitHeapCapacity * sizeof(MemoryNode*));
     }
 
-    return NULL;
+    heapPlace(allocator, node, allocator->worstFitHeapSize++);
+    heapSiftUp(allocator, node);
 }
 
-MemoryNode* findBestFit(MemoryList* list, int size) {
-    MemoryNode *best = NULL;
-    int hole = MEM_SIZE + 1;
+// Removes node from anywhere in the heap by moving the last node into its place
+void heapDelete(allocator_t* allocator, MemoryNode *node) {
+    MemoryNode *last = allocator->worstFitHeap[--allocator->worstFitHeapSize];
+    if (last == node) {
+        return;
+    }
 
-    MemoryNode *current = memoryNodes->head;
+    heapPlace(allocator, last, node->heapIndex);
+    heapSiftUp(allocator, last);
+    heapSiftDown(allocator, last);
+}
 
-    while (current != NULL) {
+int treeHeight(MemoryNode *node) {
+    return (node == NULL) ? 0 : node->height;
+}
 
-        int temp_hole = *current->size - size;
+// Recomputes node's height and maxSize from its children
+void treeUpdate(MemoryNode *node) {
+    int leftHeight = treeHeight(node->left);
+    int rightHeight = treeHeight(node->right);
+    node->height = 1 + (leftHeight > rightHeight ? leftHeight : rightHeight);
 
-        // Check for perfect fit
-        if (temp_hole == 0 && current->used == 0) {
-            current->used = 1;
-            return current;
-        } else if ((temp_hole > 0) && (temp_hole < hole) && current->used == 0) {
-            hole = temp_hole;
-            best = current;
-        }
-        current = current->next;
+    node->maxSize = node->size;
+    if (node->left != NULL && node->left->maxSize > node->maxSize) {
+        node->maxSize = node->left->maxSize;
+    }
+    if (node->right != NULL && node->right->maxSize > node->maxSize) {
+        node->maxSize = node->right->maxSize;
     }
-    if (best != NULL) {
-        split(memoryNodes, best, size);
-        best->used = 1;
+}
 
-        return best;
-    } else {
-        return NULL;
+// Orders tree nodes by size, then by address, or only by address
+int treeLess(MemoryNode *a, MemoryNode *b, int byAddress) {
+    if (byAddress) {
+        return a->start < b->start;
     }
+    return a->size < b->size || (a->size == b->size && a->start < b->start);
 }
 
-MemoryNode* findWorstFit(MemoryList* list, int size) {
-    MemoryNode *worst = NULL;
-    int hole = -1;
+// Rotates node to the left (toLeft = 1) or right and returns the new subtree root
+MemoryNode* treeRotate(MemoryNode *node, int toLeft) {
+    MemoryNode *child;
+    if (toLeft) {
+        child = node->right;
+        node->right = child->left;
+        child->left = node;
+    } else {
+        child = node->left;
+        node->left = child->right;
+        child->right = node;
+    }
+
+    treeUpdate(node);
+    treeUpdate(child);
 
-    MemoryNode *current = memoryNodes->head;
+    return child;
+}
 
-    while (current != NULL) {
+// Fixes node's height and maxSize and restores the AVL balance of its subtree
+MemoryNode* treeBalance(MemoryNode *node) {
+    treeUpdate(node);
+    int leftHeight = treeHeight(node->left);
+    int rightHeight = treeHeight(node->right);
 
-        int temp_hole = *current->size - size;
-        if((temp_hole > hole) && current->used == 0){
+    if (leftHeight - rightHeight > 1) {
+        if (treeHeight(node->left->right) > treeHeight(node->left->left)) {
+            node->left = treeRotate(node->left, 1);
+        }
+        return treeRotate(node, 0);
+    }
 
-            hole = temp_hole;
-            worst = current;
+    if (rightHeight - leftHeight > 1) {
+        if (treeHeight(node->right->left) > treeHeight(node->right->right)) {
+            node->right = treeRotate(node->right, 0);
         }
-        current = current->next;
+        return treeRotate(node, 1);
+    }
+
+    return node;
+}
+
+MemoryNode* treeInsert(MemoryNode *root, MemoryNode *node, int byAddress) {
+    if (root == NULL) {
+        return node;
     }
-    if (worst != NULL){
-        split(memoryNodes, worst, size);
-        worst->used = 1;
 
-        return worst;
+    if (treeLess(node, root, byAddress)) {
+        root->left = treeInsert(root->left, node, byAddress);
     } else {
-        return NULL;
+        root->right = treeInsert(root->right, node, byAddress);
     }
 
+    return treeBalance(root);
 }
 
-// Creates and initializes a new memory node
-MemoryNode* createNewNode(void* start, int size) {
-    MemoryNode *newNode = malloc(sizeof(MemoryNode));
-    newNode->start = start;
-    newNode->size = start;
-    *newNode->size = size;
-    newNode->used = 0;
+// Unlinks the smallest node of the subtree into min and returns the new subtree root
+MemoryNode* treeRemoveMin(MemoryNode *root, MemoryNode **min) {
+    if (root->left == NULL) {
+        *min = root;
+        return root->right;
+    }
 
-    return newNode;
+    root->left = treeRemoveMin(root->left, min);
+    return treeBalance(root);
 }
 
-// Splits a node into a given size.
-// node's size = size, and a new node is created that is the size of
-// node's original size - size
-MemoryNode* split(MemoryList* list, MemoryNode* node, int size) {
-    MemoryNode *newNode = createNewNode(node->start + size, *node->size - size);
-    listTailInsert(memoryNodes, newNode);
+// Removes node, which must be in the tree, and returns the new root
+MemoryNode* treeDelete(MemoryNode *root, MemoryNode *node, int byAddress) {
+    if (root == node) {
+        if (node->left == NULL) {
+            return node->right;
+        }
+        if (node->right == NULL) {
+            return node->left;
+        }
 
-    *(node->size) = size;
-    node->used = 0;
+        // Replace node with its successor
+        MemoryNode *successor;
+        MemoryNode *right = treeRemoveMin(node->right, &successor);
+        successor->left = node->left;
+        successor->right = right;
+        return treeBalance(successor);
+    }
 
-    return node;
+    if (treeLess(node, root, byAddress)) {
+        root->left = treeDelete(root->left, node, byAddress);
+    } else {
+        root->right = treeDelete(root->right, node, byAddress);
+    }
+
+    return treeBalance(root);
 }
 
-// Merge any adjacentfree nodes adjacent to node
-void merge(MemoryList* list, MemoryNode* node) {
-    // Look at adjacent nodes to see if there are holes we can merge all nodes into node node.
-    if (node->next->used == 0 || node->prev->used == 0) {
-        // If both nodes are free, merge all 3
-        if (node->next->used == 0 && node->next->used == 0) {
-            node->start = node->prev->start;
-            node->size = node->prev->start;
-            *(node->size) = *(node->prev->size) + *(node->next->size) + *(node->size);
+// The lowest addressed node at or after from that can hold size, in a tree
+// ordered by address. Subtrees whose maxSize is too small are skipped whole.
+MemoryNode* treeFindFrom(MemoryNode *root, void *from, size_t size) {
+    if (root == NULL || root->maxSize < size) {
+        return NULL;
+    }
 
-            node->prev = node->prev->prev;
-            node->next = node->next->next;
-            memoryNodes->size -= 2;
+    if (root->start >= from) {
+        MemoryNode *found = treeFindFrom(root->left, from, size);
+        if (found != NULL) {
+            return found;
         }
-        // If only right node is free
-        else if (node->next->used == 0) {
-            *(node->size) = *(node->next->size) + *(node->size);
-            node->next = node->next->next;
-            memoryNodes->size--;
+        if (root->size >= size) {
+            return root;
         }
-        // If only left node is free
-        else if (node->prev->used == 0) {
+    }
+
+    return treeFindFrom(root->right, from, size);
+}
+
+// Size class of a hole: floor(log2(size)), capped to the last bin
+int sizeClass(size_t size) {
+    int bin = 63 - __builtin_clzl(size);
+    return (bin < NUM_BINS) ? bin : NUM_BINS - 1;
+}
+
+// TLSF list of a hole: fl is its size class, sl the slice of the class it falls
+// in, taken from the TLSF_SL_SHIFT bits right below the leading one
+void tlsfMapping(size_t size, int *fl, int *sl) {
+    *fl = 63 - __builtin_clzl(size);
+    *sl = (int)(size >> (*fl - TLSF_SL_SHIFT)) - TLSF_SL_COUNT;
+}
+
+// Pushes a free node onto the front of its TLSF list
+void tlsfInsert(allocator_t* allocator, MemoryNode *node) {
+    int fl, sl;
+    tlsfMapping(node->size, &fl, &sl);
+
+    node->binPrev = NULL;
+    node->binNext = allocator->tlsfLists[fl][sl];
+    if (node->binNext != NULL) {
+        node->binNext->binPrev = node;
+    }
+    allocator->tlsfLists[fl][sl] = node;
+
+    allocator->tlsfSlMap[fl] |= 1u << sl;
+    allocator->tlsfFlMap |= 1ul << fl;
+}
 
-            node->start = node->prev->start;
-            node->size = node->prev->start;
-            *node->size = *node->prev->size + *node->size;
+void tlsfDelete(allocator_t* allocator, MemoryNode *node) {
+    int fl, sl;
+    tlsfMapping(node->size, &fl, &sl);
 
-            node->prev = node->prev->prev;
-            memoryNodes->size--;
+    if (node->binPrev == NULL) {
+        allocator->tlsfLists[fl][sl] = node->binNext;
+    } else {
+        node->binPrev->binNext = node->binNext;
+    }
+    if (node->binNext != NULL) {
+        node->binNext->binPrev = node->binPrev;
+    }
+
+    node->binPrev = NULL;
+    node->binNext = NULL;
+
+    if (allocator->tlsfLists[fl][sl] == NULL) {
+        allocator->tlsfSlMap[fl] &= ~(1u << sl);
+        if (allocator->tlsfSlMap[fl] == 0) {
+            allocator->tlsfFlMap &= ~(1ul << fl);
         }
-        node->used = 0;
+    }
+}
+
+// Pushes a free block onto the front of its bin. The buddy system takes any
+// block of the right order, so the bins keep no order.
+void binPush(allocator_t* allocator, MemoryNode *node) {
+    int bin = sizeClass(node->size);
+    MemoryList *list = &allocator->freeBins[bin];
+
+    node->binPrev = NULL;
+    node->binNext = list->head;
+    if (list->head == NULL) {
+        list->tail = node;
+    } else {
+        list->head->binPrev = node;
+    }
+    list->head = node;
+
+    list->size++;
+    allocator->freeBinMap |= 1ul << bin;
+}
 
+void binDelete(allocator_t* allocator, MemoryNode *node) {
+    int bin = sizeClass(node->size);
+    MemoryList *list = &allocator->freeBins[bin];
+
+    if (node->binPrev == NULL) {
+        list->head = node->binNext;
+    } else {
+        node->binPrev->binNext = node->binNext;
+    }
+
+    if (node->binNext == NULL) {
+        list->tail = node->binPrev;
     } else {
-        node->used = 0;
+        node->binNext->binPrev = node->binPrev;
+    }
+
+    node->binPrev = NULL;
+    node->binNext = NULL;
+
+    list->size--;
+    if (list->size == 0) {
+        allocator->freeBinMap &= ~(1ul << bin);
     }
 }
 
@@ -460,28 +3730,70 @@ void listHeadInsert(MemoryList *list, MemoryNode *node) {
     list->size++;
 }
 
+void listInsertAfter(MemoryList *list, MemoryNode *node, MemoryNode *newNode) {
+    newNode->prev = node;
+    newNode->next = node->next;
+    if (node->next == NULL) {
+        list->tail = newNode;
+    } else {
+        node->next->prev = newNode;
+    }
+    node->next = newNode;
+
+    list->size++;
+}
+
 void listDelete(MemoryList *list, MemoryNode *node) {
-    if (node == list->head) {
-        node->next->prev = NULL;
+    if (node->prev == NULL) {
         list->head = node->next;
-    } else if (node == list->tail) {
-        node->prev->next = NULL;
+    } else {
+        node->prev->next = node->next;
+    }
+
+    if (node->next == NULL) {
         list->tail = node->prev;
     } else {
         node->next->prev = node->prev;
-        node->prev->next = node->next;
     }
 
-    free(node);
     list->size--;
 }
 
-void printList(MemoryList *list, int showNextPrev) {
-    MemoryNode *node = list->head;
+void printList(allocator_t *allocator, int showNextPrev) {
+    MemoryList *list = &allocator->memoryNodes;
     printf("\t[LIST s=%d] \n", list->size);
+
+    if (allocator->mallocType == BUDDY_TREE) {
+        buddyTreePrint(allocator, 1);
+        printf("\n");
+        return;
+    }
+
+    // The fit policies don't keep their nodes in a list, walk the memory through the tags instead
+    if (allocator->mallocType != BUDDY_SYSTEM) {
+        void *start = allocator->memStart;
+        while (start < allocator->memStart + ROUND_DOWN(allocator->memSize)) {
+            MemoryNode *node = nodeTableFind(allocator, start);
+            printf("\t\t[node_addr=%p start=%p tag=%#zx size=%zu, used=%d]\n", node, start, *(size_t*)start, node->size, node->used);
+            start += node->size;
+        }
+        for (Region *region = allocator->regions; region != NULL; region = region->next) {
+            printf("\t[REGION start=%p size=%zu]\n", (void*)region, region->size);
+            start = (void*)(ROUND_UP((size_t)region + sizeof(Region) + HEADER_SIZE) - HEADER_SIZE);
+            while (start < region->end) {
+                MemoryNode *node = nodeTableFind(allocator, start);
+                printf("\t\t[node_addr=%p start=%p tag=%#zx size=%zu, used=%d]\n", node, start, *(size_t*)start, node->size, node->used);
+                start += node->size;
+            }
+        }
+        printf("\n");
+        return;
+    }
+
+    MemoryNode *node = list->head;
     while (node != NULL) {
-        printf("\t\t[node_addr=%p start=%p sizeptr=%p size=%d, used=%d]\n", node, node->start, node->size, *node->size, node->used);
+        printf("\t\t[node_addr=%p start=%p size=%zu, used=%d]\n", node, node->start, node->size, node->used);
         node = node->next;
     }
     printf("\n");
-}
\ No newline at end of file
+}
@@ -13,42 +13,152 @@ function verify {
 
 function testFirstFit {
     echo "[TESTING FIRST FIT]"
-    ./memory_test_1 > /dev/null 2>&1
-    ./memory_test_6 > /dev/null 2>&1
+    ../memory_test_1 > /dev/null 2>&1
+    ../memory_test_6 > /dev/null 2>&1
 
-    verify test1_output.txt ../TestOutputs/test1_output.txt
-    verify test6_output.txt ../TestOutputs/test6_output.txt
+    verify test1_output.txt ../../TestOutputs/test1_output.txt
+    verify test6_output.txt ../../TestOutputs/test6_output.txt
 }
 
 function testBestFit {
     echo "[TESTING BEST FIT]"
-    ./memory_test_2 > /dev/null 2>&1
-    ./memory_test_7 > /dev/null 2>&1
+    ../memory_test_2 > /dev/null 2>&1
+    ../memory_test_7 > /dev/null 2>&1
 
-    verify test2_output.txt ../TestOutputs/test2_output.txt
-    verify test7_output.txt ../TestOutputs/test7_output.txt
+    verify test2_output.txt ../../TestOutputs/test2_output.txt
+    verify test7_output.txt ../../TestOutputs/test7_output.txt
 }
 
 function testWorstFit {
     echo "[TESTING WORST FIT]"
-    ./memory_test_3 > /dev/null 2>&1
-    ./memory_test_8 > /dev/null 2>&1
+    ../memory_test_3 > /dev/null 2>&1
+    ../memory_test_8 > /dev/null 2>&1
 
-    verify test3_output.txt ../TestOutputs/test3_output.txt
-    verify test8_output.txt ../TestOutputs/test8_output.txt
+    verify test3_output.txt ../../TestOutputs/test3_output.txt
+    verify test8_output.txt ../../TestOutputs/test8_output.txt
 }
 
 function testBuddySystem {
     echo "[TESTING BUDDY SYSTEM]"
-    ./memory_test_4 > /dev/null 2>&1
-    ./memory_test_5 > /dev/null 2>&1
+    ../memory_test_4 > /dev/null 2>&1
+    ../memory_test_5 > /dev/null 2>&1
 
-    verify test4_output.txt ../TestOutputs/test4_output.txt
-    verify test5_output.txt ../TestOutputs/test5_output.txt
+    verify test4_output.txt ../../TestOutputs/test4_output.txt
+    verify test5_output.txt ../../TestOutputs/test5_output.txt
+}
+
+function testNextFit {
+    echo "[TESTING NEXT FIT]"
+    ../memory_test_10 > /dev/null 2>&1
+    ../memory_test_11 > /dev/null 2>&1
+
+    verify test10_output.txt ../../TestOutputs/test10_output.txt
+    verify test11_output.txt ../../TestOutputs/test11_output.txt
+}
+
+function testTlsf {
+    echo "[TESTING TLSF]"
+    ../memory_test_12 > /dev/null 2>&1
+    ../memory_test_13 > /dev/null 2>&1
+
+    verify test12_output.txt ../../TestOutputs/test12_output.txt
+    verify test13_output.txt ../../TestOutputs/test13_output.txt
+}
+
+function testBuddyTree {
+    echo "[TESTING BUDDY TREE]"
+    ../memory_test_14 > /dev/null 2>&1
+    ../memory_test_15 > /dev/null 2>&1
+
+    verify test14_output.txt ../../TestOutputs/test14_output.txt
+    verify test15_output.txt ../../TestOutputs/test15_output.txt
+}
+
+function testSharedHeap {
+    echo "[TESTING SHARED HEAP]"
+    ../memory_test_16 > /dev/null 2>&1
+
+    verify test16_output.txt ../../TestOutputs/test16_output.txt
+}
+
+function testGrowth {
+    echo "[TESTING GROWTH]"
+    ../memory_test_17 > /dev/null 2>&1
+
+    verify test17_output.txt ../../TestOutputs/test17_output.txt
+}
+
+function testStats {
+    echo "[TESTING STATS]"
+    ../memory_test_18 > /dev/null 2>&1
+
+    verify test18_output.txt ../../TestOutputs/test18_output.txt
+}
+
+function testRecord {
+    echo "[TESTING RECORD MODE]"
+    ../memory_test_19 > /dev/null 2>&1
+    ../memory_trace2text -s test19_trace > test19_output.txt 2>/dev/null
+
+    verify test19_output.txt ../../TestOutputs/test19_output.txt
+}
+
+function testThreads {
+    echo "[TESTING THREADS]"
+    ../memory_test_20 > /dev/null 2>&1
+
+    verify test20_output.txt ../../TestOutputs/test20_output.txt
+}
+
+function testMemalign {
+    echo "[TESTING MEMALIGN]"
+    ../memory_test_21 > /dev/null 2>&1
+
+    verify test21_output.txt ../../TestOutputs/test21_output.txt
+}
+
+function testRealloc {
+    echo "[TESTING REALLOC]"
+    ../memory_test_22 > /dev/null 2>&1
+
+    verify test22_output.txt ../../TestOutputs/test22_output.txt
+}
+
+function testCalloc {
+    echo "[TESTING CALLOC]"
+    ../memory_test_23 > /dev/null 2>&1
+
+    verify test23_output.txt ../../TestOutputs/test23_output.txt
+}
+
+function testBatch {
+    echo "[TESTING BATCH]"
+    ../memory_test_24 > /dev/null 2>&1
+
+    verify test24_output.txt ../../TestOutputs/test24_output.txt
+}
+
+function testHistograms {
+    echo "[TESTING HISTOGRAMS]"
+    ../memory_test_25 > /dev/null 2>&1
+
+    verify test25_output.txt ../../TestOutputs/test25_output.txt
+}
+
+function testSmallInRegions {
+    echo "[TESTING SMALL BLOCKS IN REGIONS]"
+    ../memory_test_26 > /dev/null 2>&1
+
+    verify test26_output.txt ../../TestOutputs/test26_output.txt
 }
 
 ./build.sh
 
+# The tests write their outputs, and test16 and test19 their heap and trace
+# files, into the current directory, so they run in one of their own
+mkdir -p scratch
+cd scratch
+
 if [ "$POLICY" = "all" ]
 then
     echo "[TESTING ALL POLICIES]"
@@ -56,6 +166,20 @@ then
     testBestFit
     testWorstFit
     testBuddySystem
+    testNextFit
+    testTlsf
+    testBuddyTree
+    testSharedHeap
+    testGrowth
+    testStats
+    testRecord
+    testThreads
+    testMemalign
+    testRealloc
+    testCalloc
+    testBatch
+    testHistograms
+    testSmallInRegions
 elif [ "$POLICY" = "0" ]
 then
     testFirstFit
@@ -68,4 +192,46 @@ then
 elif [ "$POLICY" = "3" ]
 then
     testBuddySystem
+elif [ "$POLICY" = "4" ]
+then
+    testNextFit
+elif [ "$POLICY" = "5" ]
+then
+    testTlsf
+elif [ "$POLICY" = "6" ]
+then
+    testBuddyTree
+elif [ "$POLICY" = "shared" ]
+then
+    testSharedHeap
+elif [ "$POLICY" = "growth" ]
+then
+    testGrowth
+elif [ "$POLICY" = "stats" ]
+then
+    testStats
+elif [ "$POLICY" = "record" ]
+then
+    testRecord
+elif [ "$POLICY" = "threads" ]
+then
+    testThreads
+elif [ "$POLICY" = "memalign" ]
+then
+    testMemalign
+elif [ "$POLICY" = "realloc" ]
+then
+    testRealloc
+elif [ "$POLICY" = "calloc" ]
+then
+    testCalloc
+elif [ "$POLICY" = "batch" ]
+then
+    testBatch
+elif [ "$POLICY" = "histograms" ]
+then
+    testHistograms
+elif [ "$POLICY" = "regions" ]
+then
+    testSmallInRegions
 fi
\ No newline at end of file
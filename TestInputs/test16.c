@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "memalloc.h"
+#include <stdbool.h>
+//***********************************************************************************
+int main()
+{
+	 FILE * pFile;
+	 pFile = fopen ("test16_output.txt","w");
+    int size;
+    int RAM_SIZE=1<<20;//1024*1024
+    unlink("test16_heap");
+    int fd=open("test16_heap",O_RDWR|O_CREAT,0600);
+	allocator_t* heap=allocator_attach(fd,RAM_SIZE);//Shared heap in a file, Region size=1024*1024
+    close(fd);
+//test 16 - a second process attaches to the heap, allocates from it and hands the block over
+    size=20*1024;
+	void* a=allocator_malloc(heap,size);
+    if ((long)a==-1)
+        fprintf(pFile, "This size can not be allocated!");
+    else
+    {
+    	fprintf(pFile, "start of the chunk a: %d\n",(int)allocator_offset(heap,a));
+    	fprintf(pFile, "End of the chunk a: %d\n\n",(int)allocator_offset(heap,a+size));
+    }
+    fflush(pFile);
+
+    if (fork()==0)
+    {
+        // The child maps the heap at an address of its own and leaves the
+        // offset of its block in a for the parent
+        int childFd=open("test16_heap",O_RDWR);
+        allocator_t* child=allocator_attach(childFd,0);
+        close(childFd);
+        void* b=allocator_malloc(child,30*1024);
+        strcpy(b,"written by the child");
+        *(size_t*)allocator_pointer(child,allocator_offset(heap,a))=allocator_offset(child,b);
+        allocator_destroy(child);
+        _exit(0);
+    }
+    wait(NULL);
+
+    size=30*1024;
+	void* b=allocator_pointer(heap,*(size_t*)a);
+    fprintf(pFile, "start of the chunk b: %d\n",(int)allocator_offset(heap,b));
+    fprintf(pFile, "End of the chunk b: %d\n",(int)allocator_offset(heap,b+size));
+    fprintf(pFile, "Contents of the chunk b: %s\n\n",(char*)b);
+
+	allocator_free(heap,b);
+
+    size=25*1024;
+	void* c=allocator_malloc(heap,size);
+    if ((long)c==-1)
+        fprintf(pFile, "This size can not be allocated!");
+    else
+    {
+    	fprintf(pFile, "start of the chunk c: %d\n",(int)allocator_offset(heap,c));
+    	fprintf(pFile, "End of the chunk c: %d\n\n",(int)allocator_offset(heap,c+size));
+    }
+
+    allocator_destroy(heap);
+    unlink("test16_heap");
+
+    // A heap too small for its own metadata is refused without touching the
+    // file, so the next attach with a proper size can still set it up
+    fd=open("test16_heap",O_RDWR|O_CREAT,0600);
+    heap=allocator_attach(fd,4096);
+    fprintf(pFile, "attach with 4096 bytes: %s, file size %ld\n",(heap==NULL) ? "refused" : "attached!",(long)lseek(fd,0,SEEK_END));
+    heap=allocator_attach(fd,RAM_SIZE);
+    fprintf(pFile, "attach with %d bytes: %s, file size %ld\n",RAM_SIZE,(heap==NULL) ? "refused!" : "attached",(long)lseek(fd,0,SEEK_END));
+    close(fd);
+    if (heap!=NULL)
+        allocator_destroy(heap);
+    unlink("test16_heap");
+    fclose (pFile);
+	return 0;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "memalloc.h"
+#include <stdbool.h>
+
+// Hands out regions from the end of RAM, past the memory given to setup
+void* RAM;
+int nextRegion=128*1024;
+void* growFromRam(size_t size, void* context)
+{
+    void* region=RAM+nextRegion;
+    nextRegion+=size;
+    return region;
+}
+//***********************************************************************************
+int main()
+{
+	 FILE * pFile;
+	 pFile = fopen ("test17_output.txt","w");
+    int size;
+    int RAM_SIZE=1<<20;//1024*1024
+    RAM=malloc(RAM_SIZE);//1024*1024
+    allocator_t* heap=allocator_setup(0,64*1024,RAM);//First Fit, Memory size=64*1024, Start of memory=RAM
+    allocator_set_growth(heap,64*1024,256*1024,growFromRam,NULL);//Grow by 64*1024 up to 256*1024 in all
+//test 17 - the heap takes new regions when nothing fits, until the ceiling
+    size=40*1024;
+	void* a=allocator_malloc(heap,size);
+    if ((long)a==-1)
+        fprintf(pFile, "This size can not be allocated!\n\n");
+    else
+    {
+    	fprintf(pFile, "start of the chunk a: %d\n",(int)(a-RAM));
+    	fprintf(pFile, "End of the chunk a: %d\n\n",(int)(a+size-RAM));
+    }
+
+    size=40*1024;
+	void* b=allocator_malloc(heap,size);
+    if ((long)b==-1)
+        fprintf(pFile, "This size can not be allocated!\n\n");
+    else
+    {
+    	fprintf(pFile, "start of the chunk b: %d\n",(int)(b-RAM));
+    	fprintf(pFile, "End of the chunk b: %d\n\n",(int)(b+size-RAM));
+    }
+
+    size=50*1024;
+	void* c=allocator_malloc(heap,size);
+    if ((long)c==-1)
+        fprintf(pFile, "This size can not be allocated!\n\n");
+    else
+    {
+    	fprintf(pFile, "start of the chunk c: %d\n",(int)(c-RAM));
+    	fprintf(pFile, "End of the chunk c: %d\n\n",(int)(c+size-RAM));
+    }
+
+    size=100*1024;
+	void* d=allocator_malloc(heap,size);
+    if ((long)d==-1)
+        fprintf(pFile, "This size can not be allocated!\n\n");
+    else
+    {
+    	fprintf(pFile, "start of the chunk d: %d\n",(int)(d-RAM));
+    	fprintf(pFile, "End of the chunk d: %d\n\n",(int)(d+size-RAM));
+    }
+
+    size=60*1024;
+	void* e=allocator_malloc(heap,size);
+    if ((long)e==-1)
+        fprintf(pFile, "This size can not be allocated!\n\n");
+    else
+    {
+    	fprintf(pFile, "start of the chunk e: %d\n",(int)(e-RAM));
+    	fprintf(pFile, "End of the chunk e: %d\n\n",(int)(e+size-RAM));
+    }
+
+
+	allocator_free(heap,b);
+
+    size=20*1024;
+	void* f=allocator_malloc(heap,size);
+    if ((long)f==-1)
+        fprintf(pFile, "This size can not be allocated!\n\n");
+    else
+    {
+    	fprintf(pFile, "start of the chunk f: %d\n",(int)(f-RAM));
+    	fprintf(pFile, "End of the chunk f: %d\n\n",(int)(f+size-RAM));
+    }
+
+    size=30*1024;
+	void* g=allocator_malloc(heap,size);
+    if ((long)g==-1)
+        fprintf(pFile, "This size can not be allocated!\n\n");
+    else
+    {
+    	fprintf(pFile, "start of the chunk g: %d\n",(int)(g-RAM));
+    	fprintf(pFile, "End of the chunk g: %d\n\n",(int)(g+size-RAM));
+    }
+
+    allocator_destroy(heap);
+    fclose (pFile);
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memalloc.h"
+#include <stdbool.h>
+//***********************************************************************************
+int main()
+{
+	 FILE * pFile;
+	 pFile = fopen ("test18_output.txt","w");
+    int RAM_SIZE=1<<20;//1024*1024
+    void* RAM=aligned_alloc(16*1024,RAM_SIZE);//Slabs line up the same way on every run
+//test 18 - the counters of every policy after the same allocations and frees
+    for (int policy=0; policy<=6; policy++)
+    {
+        memset(RAM,0,RAM_SIZE);
+        allocator_t* heap=allocator_setup(policy,RAM_SIZE,RAM);
+        void* a=allocator_malloc(heap,40*1024);
+        void* b=allocator_malloc(heap,100);
+        void* c=allocator_malloc(heap,70*1024);
+        void* d=allocator_malloc(heap,30*1024+5);
+        void* e=allocator_malloc(heap,2*RAM_SIZE);
+        allocator_free(heap,c);
+        void* f=allocator_malloc(heap,20*1024);
+        if ((long)a==-1 || (long)b==-1 || (long)d==-1 || (long)e!=-1 || (long)f==-1)
+            fprintf(pFile, "Unexpected allocation result!\n");
+
+        allocator_stats_t stats=allocator_stats(heap);
+        fprintf(pFile, "policy %d\n",stats.mallocType);
+        fprintf(pFile, "used: %zu requested: %zu wasted: %zu\n",stats.usedBytes,stats.requestedBytes,stats.wastedBytes);
+        fprintf(pFile, "free: %zu largest free: %zu fragments: %zu fragmentation: %.3f\n",stats.freeBytes,stats.largestFree,stats.freeFragments,stats.fragmentation);
+        fprintf(pFile, "mallocs: %lu frees: %lu failures: %lu\n\n",stats.mallocs,stats.frees,stats.failures);
+        allocator_destroy(heap);
+    }
+
+//slabs for small requests fit in holes barely larger than a slab
+    for (int policy=0; policy<=5; policy++)
+    {
+        if (policy==3)//Buddy blocks are aligned to their size anyway
+            continue;
+        allocator_t* heap=allocator_setup(policy,RAM_SIZE,RAM);
+        void* holes[64];
+        int count=0;
+        while (count<64)
+        {
+            holes[count]=allocator_malloc(heap,17*1024);
+            if ((long)holes[count]==-1 || (long)allocator_malloc(heap,1024)==-1)
+                break;
+            count++;
+        }
+        for (int i=0; i<count; i++)
+            allocator_free(heap,holes[i]);
+
+        void* g=allocator_malloc(heap,100);
+        allocator_stats_t stats=allocator_stats(heap);
+        fprintf(pFile, "policy %d with %zu holes of %zu bytes\n",stats.mallocType,stats.freeFragments,stats.largestFree);
+        if ((long)g==-1)
+            fprintf(pFile, "This size can not be allocated!\n\n");
+        else
+            fprintf(pFile, "start of the chunk g: %d\n\n",(int)(g-RAM));
+        allocator_destroy(heap);
+    }
+
+//a slab object freed twice is only given back once
+    for (int policy=0; policy<=6; policy++)
+    {
+        allocator_t* heap=allocator_setup(policy,RAM_SIZE,RAM);
+        void* h=allocator_malloc(heap,100);
+        void* keep=allocator_malloc(heap,100);//Keeps the slab from going back to the policy
+        allocator_free(heap,h);
+        allocator_free(heap,h);
+        allocator_stats_t stats=allocator_stats(heap);
+        fprintf(pFile, "policy %d after freeing h twice: requested %zu\n",policy,stats.requestedBytes);
+        void* i=allocator_malloc(heap,100);
+        void* j=allocator_malloc(heap,100);
+        fprintf(pFile, "%s\n\n",(i==j || i==keep || j==keep) ? "i, j and keep are not all different chunks!" : "i, j and keep are different chunks");
+        allocator_destroy(heap);
+    }
+
+    free(RAM);
+    fclose (pFile);
+	return 0;
+}
@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "memalloc.h"
+#include <stdbool.h>
+//***********************************************************************************
+int main()
+{
+    int RAM_SIZE=1<<20;//1024*1024
+    void* RAM=aligned_alloc(16*1024,RAM_SIZE);//Slabs line up the same way on every run
+	setup(0,RAM_SIZE,RAM);//First Fit, Memory size=1024*1024, Start of memory=RAM
+    int fd=open("test19_trace",O_WRONLY|O_CREAT|O_TRUNC,0600);
+    my_record(fd);
+//test 19 - every allocation and free goes into the log, test.sh turns it into test19_output.txt with trace2text
+    void* a=my_malloc(20*1024);
+    void* b=my_malloc(30*1024);
+    void* c=my_malloc(100);
+    my_free(a);
+    b=my_realloc(b,10*1024);
+    void* d=my_calloc(4,5*1024);
+    void* e[3];
+    my_malloc_batch(2*1024,3,e);
+    my_free_batch(e,3);
+    void* f=my_memalign(4096,8*1024);
+    my_free(c);
+    my_free(d);
+    my_free(f);
+    my_record(-1);
+    my_free(b);
+    close(fd);
+	return 0;
+}
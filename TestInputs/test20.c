@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "memalloc.h"
+#include <stdbool.h>
+//***********************************************************************************
+// Built with -DMEMALLOC_THREADS -pthread
+allocator_t* heap;
+void* a;
+pthread_mutex_t lock=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t changed=PTHREAD_COND_INITIALIZER;
+int step;
+
+// Runs until main is done with the heap, so its cache stays alive
+void* other(void* arg)
+{
+    void* b=allocator_malloc(heap,20*1024);//Small enough to stay in this thread's cache
+    allocator_free(heap,b);
+    allocator_free(heap,a);//Too large to be cached
+
+    pthread_mutex_lock(&lock);
+    step=1;
+    pthread_cond_broadcast(&changed);
+    while (step!=2)
+        pthread_cond_wait(&changed,&lock);
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int main()
+{
+	 FILE * pFile;
+	 pFile = fopen ("test20_output.txt","w");
+    int RAM_SIZE=1<<20;//1024*1024
+    void* RAM=aligned_alloc(16*1024,RAM_SIZE);//Slabs line up the same way on every run
+//test 20 - blocks freed by another thread, which keeps running, can be allocated again
+    for (int policy=0; policy<=6; policy++)
+    {
+        heap=allocator_setup(policy,RAM_SIZE,RAM);
+        a=allocator_malloc(heap,400*1024);
+        step=0;
+        pthread_t thread;
+        pthread_create(&thread,NULL,other,NULL);
+        pthread_mutex_lock(&lock);
+        while (step!=1)
+            pthread_cond_wait(&changed,&lock);
+        pthread_mutex_unlock(&lock);
+
+        fprintf(pFile, "policy %d\n",policy);
+        fprintf(pFile, "used while the other thread caches a block: %zu\n",allocator_stats(heap).usedBytes);
+
+        void* c=allocator_malloc(heap,400*1024);
+        if ((long)c==-1)
+            fprintf(pFile, "This size can not be allocated!\n");
+        else
+            fprintf(pFile, "start of the chunk c: %d\n",(int)(c-RAM));
+        allocator_free(heap,c);
+
+        // Only fits once the other thread's cache is taken back
+        void* d=allocator_malloc(heap,RAM_SIZE-64);
+        if ((long)d==-1)
+            fprintf(pFile, "This size can not be allocated!\n");
+        else
+            fprintf(pFile, "start of the chunk d: %d\n",(int)(d-RAM));
+        allocator_free(heap,d);
+
+        void* e=allocator_malloc(heap,3000);
+        allocator_free(heap,e);
+        allocator_free(heap,e);//Freed twice, must not be handed out twice
+        void* f=allocator_malloc(heap,3000);
+        void* g=allocator_malloc(heap,3000);
+        fprintf(pFile, "%s\n",(f==g) ? "f and g are the same chunk!" : "f and g are different chunks");
+
+        void* h=allocator_malloc(heap,100);//A slab object, cached apart from blocks
+        allocator_free(heap,h);
+        allocator_free(heap,h);
+        void* i=allocator_malloc(heap,100);
+        void* j=allocator_malloc(heap,100);
+        fprintf(pFile, "%s\n\n",(i==j) ? "i and j are the same chunk!" : "i and j are different chunks");
+
+        pthread_mutex_lock(&lock);
+        step=2;
+        pthread_cond_broadcast(&changed);
+        pthread_mutex_unlock(&lock);
+        pthread_join(thread,NULL);
+        allocator_destroy(heap);
+    }
+
+    free(RAM);
+    fclose (pFile);
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memalloc.h"
+#include <stdbool.h>
+//***********************************************************************************
+int main()
+{
+	 FILE * pFile;
+	 pFile = fopen ("test21_output.txt","w");
+    int RAM_SIZE=1<<20;//1024*1024
+    void* RAM=aligned_alloc(16*1024,RAM_SIZE);//Alignments are the same from RAM on every run
+    int policies[3]={0,3,6};//First Fit, Buddy System, Buddy Tree
+//test 21 - my_memalign and my_aligned_alloc for every alignment from 16 to 4096, freed with my_free
+    for (int i=0; i<3; i++)
+    {
+        setup(policies[i],RAM_SIZE,RAM);
+        fprintf(pFile, "policy %d\n",policies[i]);
+        void* blocks[18];
+        int count=0;
+        for (size_t alignment=16; alignment<=4096; alignment*=2)
+        {
+            void* a=my_memalign(alignment,100);
+            void* b=my_aligned_alloc(alignment,3000);
+            if ((long)a==-1 || (long)b==-1)
+            {
+                fprintf(pFile, "This size can not be allocated!\n");
+                continue;
+            }
+            fprintf(pFile, "alignment %zu: a at %d, b at %d, %s\n",alignment,(int)(a-RAM),(int)(b-RAM),
+                ((size_t)a%alignment==0 && (size_t)b%alignment==0) ? "aligned" : "NOT aligned!");
+            memset(a,1,100);
+            memset(b,1,3000);
+            blocks[count++]=a;
+            blocks[count++]=b;
+        }
+
+        // An alignment that isn't a power of two is rejected
+        void* c=my_memalign(48,100);
+        if ((long)c==-1)
+            fprintf(pFile, "This size can not be allocated!\n");
+
+        for (int j=0; j<count; j++)
+            my_free(blocks[j]);
+
+        // Only the slab the 16 byte aligned request came from is left, and it
+        // is given back as soon as nothing else fits
+        allocator_stats_t stats=my_stats();
+        fprintf(pFile, "after freeing: used %zu, free fragments %zu\n",stats.usedBytes,stats.freeFragments);
+        void* d=my_malloc(RAM_SIZE/2);
+        if ((long)d==-1)
+            fprintf(pFile, "This size can not be allocated!\n\n");
+        else
+            fprintf(pFile, "start of the chunk d: %d\n\n",(int)(d-RAM));
+    }
+
+    // From memory 16 bytes past a 32 byte boundary, a buddy block's usual
+    // pointer already has the alignment, and keeps its header as it is
+    for (int i=1; i<3; i++)
+    {
+        setup(policies[i],RAM_SIZE/2,RAM+16);
+        fprintf(pFile, "policy %d from RAM+16\n",policies[i]);
+        void* a=my_memalign(32,3000);
+        if ((long)a==-1)
+        {
+            fprintf(pFile, "This size can not be allocated!\n\n");
+            continue;
+        }
+        fprintf(pFile, "a at %d, %s\n",(int)(a-RAM),((size_t)a%32==0) ? "aligned" : "NOT aligned!");
+        allocator_stats_t stats=my_stats();
+        fprintf(pFile, "used %zu, requested %zu\n",stats.usedBytes,stats.requestedBytes);
+        a=my_realloc(a,5000);
+        stats=my_stats();
+        fprintf(pFile, "after realloc: a at %d, used %zu, requested %zu\n",(int)(a-RAM),stats.usedBytes,stats.requestedBytes);
+        my_free(a);
+        stats=my_stats();
+        fprintf(pFile, "after freeing: used %zu, requested %zu\n\n",stats.usedBytes,stats.requestedBytes);
+    }
+
+    free(RAM);
+    fclose (pFile);
+	return 0;
+}
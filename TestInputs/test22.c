@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memalloc.h"
+#include <stdbool.h>
+//***********************************************************************************
+int main()
+{
+	 FILE * pFile;
+	 pFile = fopen ("test22_output.txt","w");
+    int RAM_SIZE=1<<20;//1024*1024
+    void* RAM=aligned_alloc(16*1024,RAM_SIZE);//Slabs line up the same way on every run
+//test 22 - my_realloc grows and shrinks in place when it can and copies when it can't
+    setup(0,RAM_SIZE,RAM);//First Fit, Memory size=1024*1024, Start of memory=RAM
+    void* a=my_malloc(20*1024);
+    void* b=my_malloc(20*1024);
+    void* c=my_malloc(20*1024);
+    my_free(b);
+    fprintf(pFile, "start of the chunk a: %d\n",(int)(a-RAM));
+    fprintf(pFile, "start of the chunk c: %d\n",(int)(c-RAM));
+
+    // b's hole lies right behind a
+    void* grown=my_realloc(a,35*1024);
+    fprintf(pFile, "a grown to 35K: %s, free fragments %zu\n",(grown==a) ? "in place" : "moved!",my_stats().freeFragments);
+
+    // The tail merges with what is left of b's hole, so 28K fit between a and c
+    void* shrunk=my_realloc(grown,5*1024);
+    fprintf(pFile, "a shrunk to 5K: %s, free fragments %zu\n",(shrunk==a) ? "in place" : "moved!",my_stats().freeFragments);
+    void* d=my_malloc(28*1024);
+    fprintf(pFile, "start of the chunk d: %d\n\n",(int)(d-RAM));
+
+    // c is right behind d, so a can only grow by moving
+    my_free(d);
+    d=my_malloc(30*1024);
+    memset(a,'a',5*1024);
+    void* moved=my_realloc(a,50*1024);
+    if ((long)moved==-1)
+        fprintf(pFile, "This size can not be allocated!\n");
+    else
+    {
+        char expected[5*1024];
+        memset(expected,'a',sizeof(expected));
+        fprintf(pFile, "a grown to 50K: %s to %d, contents %s\n",(moved==a) ? "in place!" : "moved",(int)(moved-RAM),
+            (memcmp(moved,expected,sizeof(expected))==0) ? "kept" : "lost!");
+    }
+
+    // NULL is a plain malloc, 0 bytes a plain free
+    void* e=my_realloc(NULL,2000);
+    fprintf(pFile, "start of the chunk e: %d\n",(int)(e-RAM));
+    void* f=my_realloc(e,0);
+    fprintf(pFile, "e resized to 0: %s\n",(f==NULL) ? "NULL" : "not NULL!");
+    void* g=my_malloc(2000);
+    fprintf(pFile, "start of the chunk g: %d\n\n",(int)(g-RAM));
+
+    // A buddy block whose buddy is free becomes the block of both
+    setup(3,RAM_SIZE,RAM);//Buddy System, Memory size=1024*1024, Start of memory=RAM
+    void* h=my_malloc(3000);
+    fprintf(pFile, "start of the chunk h: %d\n",(int)(h-RAM));
+    memset(h,'h',3000);
+    void* hGrown=my_realloc(h,7000);
+    fprintf(pFile, "h grown to 7000: %s, contents %s\n",(hGrown==h) ? "in place" : "moved!",
+        (((char*)hGrown)[0]=='h' && ((char*)hGrown)[2999]=='h') ? "kept" : "lost!");
+    void* i=my_malloc(3000);
+    fprintf(pFile, "start of the chunk i: %d\n",(int)(i-RAM));
+
+    // Now h's buddy is used, so growing again has to move it
+    void* hMoved=my_realloc(hGrown,12000);
+    fprintf(pFile, "h grown to 12000: %s to %d, contents %s\n",(hMoved==h) ? "in place!" : "moved",(int)(hMoved-RAM),
+        (((char*)hMoved)[0]=='h' && ((char*)hMoved)[2999]=='h') ? "kept" : "lost!");
+
+    free(RAM);
+    fclose (pFile);
+	return 0;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memalloc.h"
+#include <stdbool.h>
+
+// Whether all size bytes from ptr are zero
+bool allZero(void* ptr, size_t size)
+{
+    for (size_t i=0; i<size; i++)
+        if (((unsigned char*)ptr)[i]!=0)
+            return false;
+    return true;
+}
+
+void printCalloc(FILE* pFile, const char* name, void* ptr, size_t size, void* RAM)
+{
+    if ((long)ptr==-1)
+        fprintf(pFile, "This size can not be allocated!\n");
+    else
+        fprintf(pFile, "start of the chunk %s: %d, %s\n",name,(int)(ptr-RAM),allZero(ptr,size) ? "zero" : "NOT zero!");
+}
+//***********************************************************************************
+int main()
+{
+	 FILE * pFile;
+	 pFile = fopen ("test23_output.txt","w");
+    int RAM_SIZE=1<<20;//1024*1024
+    void* RAM=aligned_alloc(16*1024,RAM_SIZE);//Slabs line up the same way on every run
+//test 23 - my_calloc clears blocks that were written before they were freed, with and without MEMALLOC_ZEROED
+    for (int zeroed=0; zeroed<=1; zeroed++)
+    {
+        for (int policy=0; policy<=6; policy++)
+        {
+            // Memory that isn't promised to be zero starts out full of garbage
+            memset(RAM,zeroed ? 0 : 0xAA,RAM_SIZE);
+            setup(policy | (zeroed ? MEMALLOC_ZEROED : 0),RAM_SIZE,RAM);
+            fprintf(pFile, "policy %d%s\n",policy,zeroed ? " with MEMALLOC_ZEROED" : "");
+
+            // e comes from memory nothing was written to yet
+            void* e=my_calloc(100,200);
+            printCalloc(pFile,"e",e,100*200,RAM);
+
+            // a takes all the rest, so c can only go where a was
+            void* b=my_malloc(100);
+            size_t size=my_stats().largestFree-64;
+            void* a=my_malloc(size);
+            memset(a,0xFF,size);
+            memset(b,0xFF,100);
+            my_free(a);
+            my_free(b);
+            void* c=my_calloc(1,size);
+            void* d=my_calloc(1,100);
+            fprintf(pFile, "start of the chunk a: %d\n",(int)(a-RAM));
+            printCalloc(pFile,"c",c,size,RAM);
+            fprintf(pFile, "start of the chunk b: %d\n",(int)(b-RAM));
+            printCalloc(pFile,"d",d,100,RAM);
+            fprintf(pFile, "\n");
+        }
+    }
+
+    free(RAM);
+    fclose (pFile);
+	return 0;
+}
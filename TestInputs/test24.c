@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memalloc.h"
+#include <stdbool.h>
+//***********************************************************************************
+int main()
+{
+	 FILE * pFile;
+	 pFile = fopen ("test24_output.txt","w");
+    int RAM_SIZE=1<<20;//1024*1024
+    void* RAM=aligned_alloc(16*1024,RAM_SIZE);//Slabs line up the same way on every run
+//test 24 - my_malloc_batch carves one run of blocks, my_free_batch merges them back in any order
+    for (int policy=0; policy<=6; policy++)
+    {
+        setup(policy,RAM_SIZE,RAM);
+        fprintf(pFile, "policy %d\n",policy);
+
+        void* blocks[16];
+        size_t count=my_malloc_batch(3000,8,blocks);
+        fprintf(pFile, "allocated %zu of 8:",count);
+        for (size_t i=0; i<count; i++)
+            fprintf(pFile, " %d",(int)(blocks[i]-RAM));
+        fprintf(pFile, "\n");
+
+        // Freed out of address order, they still end up as one hole with the rest
+        void* shuffled[8];
+        int order[8]={5,2,7,0,3,6,1,4};
+        for (int i=0; i<8; i++)
+            shuffled[i]=blocks[order[i]];
+        my_free_batch(shuffled,8);
+        allocator_stats_t stats=my_stats();
+        fprintf(pFile, "after freeing: used %zu, free fragments %zu, largest free %zu\n",stats.usedBytes,stats.freeFragments,stats.largestFree);
+
+        // Only some of these fit, the rest of blocks is set to -1
+        count=my_malloc_batch(100*1024,16,blocks);
+        int unset=0;
+        for (int i=count; i<16; i++)
+            if ((long)blocks[i]!=-1)
+                unset++;
+        fprintf(pFile, "allocated %zu of 16, %d of the rest not set to -1\n",count,unset);
+        my_free_batch(blocks,count);
+        stats=my_stats();
+        fprintf(pFile, "after freeing: used %zu, free fragments %zu, largest free %zu\n\n",stats.usedBytes,stats.freeFragments,stats.largestFree);
+    }
+
+    free(RAM);
+    fclose (pFile);
+	return 0;
+}
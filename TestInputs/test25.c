@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memalloc.h"
+#include <stdbool.h>
+//***********************************************************************************
+// Built with -DMEMALLOC_HISTOGRAMS
+int main()
+{
+	 FILE * pFile;
+	 pFile = fopen ("test25_output.txt","w");
+    int RAM_SIZE=1<<20;//1024*1024
+    void* RAM=aligned_alloc(16*1024,RAM_SIZE);//Slabs line up the same way on every run
+//test 25 - the histograms count every call by operation and size class
+    for (int policy=0; policy<=6; policy++)
+    {
+        setup(policy,RAM_SIZE,RAM);
+        void* small[100];
+        void* large[50];
+        for (int i=0; i<100; i++)
+            small[i]=my_malloc(100);
+        for (int i=0; i<50; i++)
+            large[i]=my_malloc(3000);
+        for (int i=0; i<100; i++)
+            my_free(small[i]);
+        for (int i=0; i<50; i++)
+            my_free(large[i]);
+        void* failed=my_malloc(2*RAM_SIZE);//Failures are timed too
+        if ((long)failed!=-1)
+            fprintf(pFile, "Unexpected allocation result!\n");
+
+        // The latencies differ from run to run, only the counts and their order are compared
+        FILE* dump=tmpfile();
+        my_dump_histograms(dump);
+        rewind(dump);
+        fprintf(pFile, "policy %d\n",policy);
+        char line[256];
+        while (fgets(line,sizeof(line),dump)!=NULL)
+        {
+            char* calls=strstr(line," calls=");
+            unsigned long count,p50,p99,p999,max;
+            if (calls==NULL || sscanf(calls," calls=%lu p50=%luns p99=%luns p999=%luns max=%luns",&count,&p50,&p99,&p999,&max)!=5)
+            {
+                fprintf(pFile, "Unexpected line: %s",line);
+                continue;
+            }
+            *calls='\0';
+            fprintf(pFile, "%s calls=%lu %s\n",line,count,(p50<=p99 && p99<=p999 && p999<=max) ? "percentiles in order" : "percentiles out of order!");
+        }
+        fclose(dump);
+        fprintf(pFile, "\n");
+    }
+
+    free(RAM);
+    fclose (pFile);
+	return 0;
+}
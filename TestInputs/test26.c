@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memalloc.h"
+#include <stdbool.h>
+
+// Hands out regions from RAM, 4096 bytes past a 16*1024 boundary, so a
+// region's first slab starts in one slab window and reaches into the next
+void* RAM;
+int nextRegion;
+void* growFromRam(size_t size, void* context)
+{
+    void* region=RAM+nextRegion;
+    nextRegion+=(size+16*1024-1)/(16*1024)*16*1024;
+    return region;
+}
+//***********************************************************************************
+int main()
+{
+	 FILE * pFile;
+	 pFile = fopen ("test26_output.txt","w");
+    int RAM_SIZE=1<<20;//1024*1024
+    RAM=aligned_alloc(16*1024,RAM_SIZE);//Slabs line up the same way on every run
+//test 26 - small blocks in regions added since setup are freed and reallocated like any others
+    int policies[5]={0,1,2,4,5};//The policies that grow
+    for (int i=0; i<5; i++)
+    {
+        int policy=policies[i];
+        nextRegion=256*1024+4096;
+        allocator_t* heap=allocator_setup(policy,64*1024,RAM);
+        allocator_set_growth(heap,64*1024,512*1024,growFromRam,NULL);
+        fprintf(pFile, "policy %d\n",policy);
+
+        // Nothing small fits in the memory given to setup any more
+        void* big=allocator_malloc(heap,60*1024);
+
+        void* small[20];
+        int inRegions=0;
+        for (int j=0; j<20; j++)
+        {
+            small[j]=allocator_malloc(heap,600);
+            if ((long)small[j]!=-1 && small[j]>=RAM+256*1024)
+                inRegions++;
+        }
+        fprintf(pFile, "%d of 20 small blocks in regions\n",inRegions);
+
+        int failed=0;
+        for (int j=0; j<20; j++)
+        {
+            void* moved=allocator_realloc(heap,small[j],700);
+            if ((long)moved==-1)
+                failed++;
+            else
+                small[j]=moved;
+        }
+        fprintf(pFile, "%d reallocs failed\n",failed);
+
+        for (int j=0; j<20; j++)
+            allocator_free(heap,small[j]);
+        allocator_free(heap,big);
+        allocator_stats_t stats=allocator_stats(heap);
+        fprintf(pFile, "after freeing: used %zu, requested %zu\n",stats.usedBytes,stats.requestedBytes);
+
+        // A request that can neither fit nor grow gives back the empty slab kept for the class
+        void* huge=allocator_malloc(heap,500*1024);
+        if ((long)huge!=-1)
+            fprintf(pFile, "Unexpected allocation result!\n");
+        stats=allocator_stats(heap);
+        fprintf(pFile, "after trimming: used %zu, requested %zu\n\n",stats.usedBytes,stats.requestedBytes);
+        allocator_destroy(heap);
+    }
+
+    free(RAM);
+    fclose (pFile);
+	return 0;
+}
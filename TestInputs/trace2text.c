@@ -0,0 +1,91 @@
+// Turns a log written in record mode (my_record) into a text trace that
+// memory_bench can replay. Every event becomes one line,
+//
+//   a <object> <size> t=<ns> thread=<thread>
+//   f <object> t=<ns> thread=<thread>
+//
+// where t is the time since recording started. The object is a number that
+// stands for the block's address, so it comes back once the block is freed
+// and handed out again.
+//
+// usage: memory_trace2text [-s] log
+//
+// -s leaves out the times and threads, which differ from run to run.
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECORD_MAGIC "memtrace"
+
+int readVarint(FILE*, unsigned long*);
+
+int main(int argc, char **argv) {
+    int bare = 0;
+    int option;
+    while ((option = getopt(argc, argv, "s")) != -1) {
+        if (option == 's') {
+            bare = 1;
+        } else {
+            optind = argc;
+            break;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-s] log\n", argv[0]);
+        return 1;
+    }
+
+    FILE *log = fopen(argv[optind], "rb");
+    if (log == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    char magic[sizeof(RECORD_MAGIC) - 1];
+    if (fread(magic, 1, sizeof(magic), log) != sizeof(magic) || memcmp(magic, RECORD_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s: not a record mode log\n", argv[optind]);
+        return 1;
+    }
+
+    unsigned long time = 0;
+    unsigned long delta, thread, object, size;
+    while (readVarint(log, &delta)) {
+        int free = delta & 1;
+        if (!readVarint(log, &thread) || !readVarint(log, &object) || (!free && !readVarint(log, &size))) {
+            fprintf(stderr, "%s: cut off in the middle of an event\n", argv[optind]);
+            return 1;
+        }
+        time += delta >> 1;
+
+        if (free) {
+            printf("f %lu", object);
+        } else {
+            printf("a %lu %lu", object, size);
+        }
+        if (!bare) {
+            printf(" t=%lu thread=%lu", time, thread);
+        }
+        printf("\n");
+    }
+
+    fclose(log);
+    return 0;
+}
+
+// Reads a varint, seven bits to a byte from the lowest with the high bit set
+// on all but the last. Returns 0 at the end of the log.
+int readVarint(FILE *log, unsigned long *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = getc(log);
+        if (byte == EOF) {
+            return 0;
+        }
+
+        *value |= (unsigned long)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
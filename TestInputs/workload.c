@@ -0,0 +1,431 @@
+// Generates a synthetic workload of millions of allocations and frees and
+// runs it against the allocation policies, reporting how fast each one gets
+// through it and how fragmented its heap is while it does.
+//
+// usage: memory_workload [-p policy] [-m mem_size] [-n ops] [-d sizes]
+//                        [-z min-max] [-l lifetimes] [-o occupancy]
+//                        [-r seed] [-t trace]
+//
+// Sizes run from min to max (16-64k by default) and are drawn from one of
+//
+//   uniform  every size equally likely
+//   zipf     a power law, a size s about as likely as s^-1.5, the default
+//   bimodal  nine in ten between min and 16 * min, the rest between max / 16
+//            and max
+//   classes  only min, 2 * min, 4 * min and so on up to max, the k-th of them
+//            picked about as often as 1 / k
+//
+// The workload allocates until occupancy bytes (half of mem_size by default)
+// are live and then holds the heap around that, allocating less often the
+// more is live, until it has done ops operations (2000000 by default). Which
+// object a free picks is set by the lifetimes,
+//
+//   lifo     the newest one, so objects die in the order opposite to birth
+//   fifo     the oldest one
+//   random   any live one, the default
+//   tail     any live one, except that one in 16 objects lives until the end,
+//            while those hold less than a quarter of the occupancy
+//
+// and at the end everything still live is freed. The operations are drawn
+// once from seed and every policy (0 to 6, or all of them side by side if
+// there is no -p) runs the same ones in a fresh heap of mem_size bytes (64M
+// by default, k, m and g suffixes are understood). Allocations that fail are
+// counted and their frees skipped. With -t the workload is also written to
+// trace as a text trace memory_bench can replay.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "bench_common.h"
+
+#define SAMPLES 20
+#define ZIPF_ALPHA 1.5
+// One in TAIL_SHARE objects is long lived with the tail lifetimes
+#define TAIL_SHARE 16
+
+const char *sizeNames[] = {"uniform", "zipf", "bimodal", "classes", NULL};
+const char *lifetimeNames[] = {"lifo", "fifo", "random", "tail", NULL};
+
+enum {UNIFORM, ZIPF, BIMODAL, CLASSES};
+enum {LIFO, FIFO, RANDOM, TAIL};
+
+// The operations of the workload. Every allocation is a new object,
+// numbered in the order they are made.
+typedef struct Workload Workload;
+struct Workload {
+    int sizes;
+    size_t minSize;
+    size_t maxSize;
+    int lifetimes;
+    size_t occupancy;
+    unsigned long seed;
+    Event *events;
+    size_t eventCount;
+    size_t objectCount;
+    // The events from the one that first brings the heap to its occupancy to
+    // the first of the teardown
+    size_t steadyStart;
+    size_t steadyEnd;
+    // The most bytes live at once if every allocation succeeds
+    size_t peakLive;
+};
+
+typedef struct Result Result;
+struct Result {
+    Run run;
+    // Fragmentation and free blocks averaged over samples of the steady
+    // state, and the heap as it was when the teardown began
+    double fragmentation;
+    double freeFragments;
+    allocator_stats_t end;
+    int samples;
+};
+
+// The live objects in the order they were allocated, a ring buffer that
+// doubles when it is full
+typedef struct Ring Ring;
+struct Ring {
+    size_t *objects;
+    size_t capacity;
+    size_t head;
+    size_t count;
+};
+
+void generate(Workload*, size_t);
+size_t drawSize(Workload*, unsigned long*);
+void addEvent(Workload*, size_t*, int, size_t, size_t);
+void ringPush(Ring*, size_t);
+size_t ringTake(Ring*, size_t);
+unsigned long nextRandom(unsigned long*);
+double uniformRandom(unsigned long*);
+void replayWorkload(Workload*, int, size_t, Result*);
+void addSample(void*, size_t, size_t, allocator_stats_t*);
+void report(Workload*, int*, int, Result*);
+int writeTrace(Workload*, const char*);
+int lookupName(const char**, const char*);
+
+int main(int argc, char **argv) {
+    int policies[POLICIES];
+    int policyCount = POLICIES;
+    size_t memSize = 64ul << 20;
+    size_t ops = 2000000;
+    const char *tracePath = NULL;
+    Workload workload = {ZIPF, 16, 64ul << 10, RANDOM, 0, 1, NULL, 0, 0, 0, 0, 0};
+    for (int policy = 0; policy < POLICIES; policy++) {
+        policies[policy] = policy;
+    }
+
+    int ok = 1;
+    int option;
+    while (ok && (option = getopt(argc, argv, "p:m:n:d:z:l:o:r:t:")) != -1) {
+        char *max;
+        if (option == 'p') {
+            policies[0] = atoi(optarg);
+            policyCount = 1;
+            ok = policies[0] >= 0 && policies[0] < POLICIES;
+        } else if (option == 'm') {
+            memSize = parseSize(optarg);
+            ok = memSize > 0;
+        } else if (option == 'n') {
+            ops = parseSize(optarg);
+            ok = ops > 0;
+        } else if (option == 'd') {
+            workload.sizes = lookupName(sizeNames, optarg);
+            ok = workload.sizes >= 0;
+        } else if (option == 'z' && (max = strchr(optarg, '-')) != NULL) {
+            *max++ = '\0';
+            workload.minSize = parseSize(optarg);
+            workload.maxSize = parseSize(max);
+            ok = workload.minSize > 0 && workload.minSize <= workload.maxSize;
+        } else if (option == 'l') {
+            workload.lifetimes = lookupName(lifetimeNames, optarg);
+            ok = workload.lifetimes >= 0;
+        } else if (option == 'o') {
+            workload.occupancy = parseSize(optarg);
+            ok = workload.occupancy > 0;
+        } else if (option == 'r') {
+            workload.seed = strtoul(optarg, NULL, 10);
+        } else if (option == 't') {
+            tracePath = optarg;
+        } else {
+            ok = 0;
+        }
+    }
+    if (!ok || optind != argc) {
+        fprintf(stderr, "usage: %s [-p policy] [-m mem_size] [-n ops] [-d uniform|zipf|bimodal|classes] [-z min-max] [-l lifo|fifo|random|tail] [-o occupancy] [-r seed] [-t trace]\n", argv[0]);
+        return 1;
+    }
+    if (workload.occupancy == 0) {
+        workload.occupancy = memSize / 2;
+    }
+
+    generate(&workload, ops);
+    if (tracePath != NULL && !writeTrace(&workload, tracePath)) {
+        return 1;
+    }
+
+    Result *results = malloc(policyCount * sizeof(Result));
+    for (int p = 0; p < policyCount; p++) {
+        replayWorkload(&workload, policies[p], memSize, &results[p]);
+    }
+    report(&workload, policies, policyCount, results);
+
+    free(results);
+    free(workload.events);
+    return 0;
+}
+
+// Draws the events of the workload, ops of them before the teardown
+void generate(Workload *workload, size_t ops) {
+    unsigned long random = workload->seed << 1 | 1;
+    size_t capacity = 1024;
+    workload->events = malloc(capacity * sizeof(Event));
+    workload->eventCount = 0;
+    workload->objectCount = 0;
+    workload->steadyStart = 0;
+    workload->peakLive = 0;
+
+    // The size of every object, and the long lived ones of the tail lifetimes
+    // apart from the others
+    size_t sizesCapacity = 1024;
+    size_t *sizes = malloc(sizesCapacity * sizeof(size_t));
+    Ring ring = {NULL, 0, 0, 0};
+    Ring longLived = {NULL, 0, 0, 0};
+    size_t live = 0;
+    size_t longLivedBytes = 0;
+
+    while (workload->eventCount < ops) {
+        // Below the occupancy the workload only allocates, above it the
+        // chance of another allocation falls off as more is live, which
+        // keeps the heap around the occupancy
+        int allocate = ring.count == 0;
+        if (!allocate && workload->steadyStart == 0) {
+            allocate = live < workload->occupancy;
+            workload->steadyStart = allocate ? 0 : workload->eventCount;
+        } else if (!allocate) {
+            allocate = uniformRandom(&random) * (live + workload->occupancy) < workload->occupancy;
+        }
+
+        if (allocate) {
+            size_t size = drawSize(workload, &random);
+            size_t object = workload->objectCount++;
+            if (object == sizesCapacity) {
+                sizesCapacity *= 2;
+                sizes = realloc(sizes, sizesCapacity * sizeof(size_t));
+            }
+            sizes[object] = size;
+            live += size;
+            workload->peakLive = (live > workload->peakLive) ? live : workload->peakLive;
+
+            if (workload->lifetimes == TAIL && nextRandom(&random) % TAIL_SHARE == 0 && (longLivedBytes + size) * 4 <= workload->occupancy) {
+                ringPush(&longLived, object);
+                longLivedBytes += size;
+            } else {
+                ringPush(&ring, object);
+            }
+            addEvent(workload, &capacity, 0, object, size);
+        } else {
+            size_t at = 0;
+            if (workload->lifetimes == LIFO) {
+                at = ring.count - 1;
+            } else if (workload->lifetimes != FIFO) {
+                at = nextRandom(&random) % ring.count;
+            }
+            size_t object = ringTake(&ring, at);
+            live -= sizes[object];
+            addEvent(workload, &capacity, 1, object, 0);
+        }
+    }
+    workload->steadyEnd = workload->eventCount;
+    if (workload->steadyStart == 0) {
+        workload->steadyStart = workload->eventCount;
+    }
+
+    // The teardown frees the objects in the order their lifetimes would,
+    // the long lived ones last
+    while (ring.count > 0) {
+        size_t object = ringTake(&ring, (workload->lifetimes == LIFO) ? ring.count - 1 : 0);
+        addEvent(workload, &capacity, 1, object, 0);
+    }
+    while (longLived.count > 0) {
+        addEvent(workload, &capacity, 1, ringTake(&longLived, 0), 0);
+    }
+
+    free(sizes);
+    free(ring.objects);
+    free(longLived.objects);
+}
+
+// A size between the workload's smallest and largest, from its distribution
+size_t drawSize(Workload *workload, unsigned long *random) {
+    size_t min = workload->minSize;
+    size_t max = workload->maxSize;
+    if (workload->sizes == UNIFORM) {
+        return min + nextRandom(random) % (max - min + 1);
+    } else if (workload->sizes == ZIPF) {
+        // Inverts the distribution function of a power law cut off at min
+        // and max
+        double low = pow(min, 1 - ZIPF_ALPHA);
+        double high = pow(max + 1, 1 - ZIPF_ALPHA);
+        size_t size = pow(low + uniformRandom(random) * (high - low), 1 / (1 - ZIPF_ALPHA));
+        return (size < min) ? min : (size > max) ? max : size;
+    } else if (workload->sizes == BIMODAL) {
+        size_t smallMax = (min * 16 < max) ? min * 16 : max;
+        size_t largeMin = (max / 16 > min) ? max / 16 : min;
+        if (nextRandom(random) % 10 != 0) {
+            return min + nextRandom(random) % (smallMax - min + 1);
+        }
+        return largeMin + nextRandom(random) % (max - largeMin + 1);
+    }
+
+    // Picks class k with a weight of 1 / (k + 1)
+    double total = 0;
+    int classes = 0;
+    for (size_t size = min; size <= max && size >= min; size *= 2) {
+        total += 1.0 / ++classes;
+    }
+    double pick = uniformRandom(random) * total;
+    size_t size = min;
+    for (int k = 1; k < classes; k++) {
+        pick -= 1.0 / k;
+        if (pick < 0) {
+            break;
+        }
+        size *= 2;
+    }
+    return size;
+}
+
+void addEvent(Workload *workload, size_t *capacity, int free, size_t object, size_t size) {
+    if (workload->eventCount == *capacity) {
+        *capacity *= 2;
+        workload->events = realloc(workload->events, *capacity * sizeof(Event));
+    }
+    workload->events[workload->eventCount].free = free;
+    workload->events[workload->eventCount].object = object;
+    workload->events[workload->eventCount].size = size;
+    workload->eventCount++;
+}
+
+void ringPush(Ring *ring, size_t object) {
+    // Doubles the buffer, moving the objects that wrapped around past its
+    // old end
+    if (ring->count == ring->capacity) {
+        size_t old = ring->capacity;
+        ring->capacity = (old == 0) ? 1024 : old * 2;
+        ring->objects = realloc(ring->objects, ring->capacity * sizeof(size_t));
+        if (ring->head + ring->count > old) {
+            memcpy(ring->objects + old, ring->objects, (ring->head + ring->count - old) * sizeof(size_t));
+        }
+    }
+    ring->objects[(ring->head + ring->count++) & (ring->capacity - 1)] = object;
+}
+
+// Takes the object at position at out of the ring. The oldest and the newest
+// keep the order of the rest, any other is replaced by the newest.
+size_t ringTake(Ring *ring, size_t at) {
+    size_t mask = ring->capacity - 1;
+    size_t object = ring->objects[(ring->head + at) & mask];
+    if (at == 0) {
+        ring->head = (ring->head + 1) & mask;
+    } else {
+        ring->objects[(ring->head + at) & mask] = ring->objects[(ring->head + ring->count - 1) & mask];
+    }
+    ring->count--;
+    return object;
+}
+
+// xorshift64*, so a seed draws the same workload everywhere. The state must
+// never be 0, generate makes it odd.
+unsigned long nextRandom(unsigned long *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ul;
+}
+
+// Between 0 and 1, 1 excluded
+double uniformRandom(unsigned long *state) {
+    return (nextRandom(state) >> 11) * (1.0 / (1ul << 53));
+}
+
+// Runs the workload against policy in a heap of memSize bytes and fills in
+// result, sampling the heap through the steady state
+void replayWorkload(Workload *workload, int policy, size_t memSize, Result *result) {
+    memset(result, 0, sizeof(Result));
+    Sampling sampling = {workload->steadyStart, workload->steadyEnd, SAMPLES, addSample, result};
+    replay(workload->events, workload->eventCount, workload->objectCount, policy, memSize, &sampling, &result->run);
+
+    result->fragmentation /= (result->samples > 0) ? result->samples : 1;
+    result->freeFragments /= (result->samples > 0) ? result->samples : 1;
+}
+
+// Adds a sample of the heap to the averages in the Result that is context
+void addSample(void *context, size_t events, size_t live, allocator_stats_t *stats) {
+    Result *result = context;
+    (void)events;
+    (void)live;
+    result->fragmentation += stats->fragmentation;
+    result->freeFragments += stats->freeFragments;
+    result->end = *stats;
+    result->samples++;
+}
+
+// Prints the results of every policy side by side
+void report(Workload *workload, int *policies, int policyCount, Result *results) {
+    printf("[WORKLOAD %s sizes %zu-%zu, %s lifetimes, occupancy %zu, seed %lu] %zu events, %zu objects, at most %zu bytes live\n\n",
+           sizeNames[workload->sizes], workload->minSize, workload->maxSize, lifetimeNames[workload->lifetimes],
+           workload->occupancy, workload->seed, workload->eventCount, workload->objectCount, workload->peakLive);
+
+    printf("%-14s %10s %10s %10s %14s %14s %14s %11s %10s\n", "policy", "Mops/s", "failed", "peak live", "peak footprint",
+           "footprint/live", "fragmentation", "free blocks", "wasted");
+    for (int p = 0; p < policyCount; p++) {
+        Result *result = &results[p];
+        Run *run = &result->run;
+        double mops = (run->seconds > 0) ? workload->eventCount / run->seconds / 1e6 : 0;
+        double ratio = (run->peakLive > 0) ? (double)run->peakFootprint / run->peakLive : 0;
+        double wasted = (result->end.usedBytes > 0) ? (double)result->end.wastedBytes / result->end.usedBytes : 0;
+        printf("%-14s %10.2f %10zu %10zu %14zu %14.2f %14.3f %11.0f %10.3f\n", policyNames[policies[p]], mops, run->failures,
+               run->peakLive, run->peakFootprint, ratio, result->fragmentation, result->freeFragments, wasted);
+    }
+    printf("\nfragmentation (1 - largest free / free) and free blocks are averaged over the steady state,\n");
+    printf("wasted is the share of the used bytes callers didn't ask for when the teardown began\n\n");
+}
+
+// Writes the workload to path as a text trace, the objects as ids. Returns
+// 0 after printing what is wrong if it can't.
+int writeTrace(Workload *workload, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    fprintf(file, "# memory_workload: %s sizes %zu-%zu, %s lifetimes, occupancy %zu, seed %lu\n", sizeNames[workload->sizes],
+            workload->minSize, workload->maxSize, lifetimeNames[workload->lifetimes], workload->occupancy, workload->seed);
+    for (size_t i = 0; i < workload->eventCount; i++) {
+        Event *event = &workload->events[i];
+        if (event->free) {
+            fprintf(file, "f %zu\n", event->object);
+        } else {
+            fprintf(file, "a %zu %zu\n", event->object, event->size);
+        }
+    }
+
+    if (fclose(file) != 0) {
+        perror(path);
+        return 0;
+    }
+    return 1;
+}
+
+// The position of name in the NULL terminated names, or -1
+int lookupName(const char **names, const char *name) {
+    for (int i = 0; names[i] != NULL; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}